@@ -0,0 +1,124 @@
+
+// Dispatch overhead of the glue: calls made the way a host makes them,
+// through the clap_plugin and clap_plugin_params function tables, against
+// the same plug_ methods called directly (where the compiler is free to
+// inline them). The difference is what the trampolines cost per call,
+// which should be no more than the indirect call itself.
+
+#include "bench-plugin.h"
+
+#include <chrono>
+#include <cstdio>
+
+template <> clap_plugin_descriptor bench::BenchGainDefault::plug_desc =
+{
+    .clap_version = CLAP_VERSION,
+    .id = "bench.gain",
+    .name = "Bench Gain",
+    .vendor = "",
+    .url = "",
+    .manual_url = "",
+    .support_url = "",
+    .version = "",
+    .description = "",
+    .features = bench::features,
+};
+
+namespace
+{
+    typedef dust::ClapWrapper<bench::BenchGainDefault> Wrapper;
+
+    // hide a pointer from the optimizer, so calls through it can't be
+    // resolved at compile time (or hoisted out of the loop)
+    template <typename T> T * opaque(T * p)
+    {
+        asm volatile("" : "+r"(p));
+        return p;
+    }
+
+    const unsigned nCalls = 20000000;
+
+    template <typename Fn>
+    double time_calls(Fn && fn)
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        double best = 0;
+        for(int r = 0; r < 5; ++r)
+        {
+            auto t0 = Clock::now();
+            for(unsigned i = 0; i < nCalls; ++i) fn();
+            auto t1 = Clock::now();
+
+            double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+            if(!r || ns < best) best = ns;
+        }
+        return best / nCalls;
+    }
+
+    void report(const char * name, double host, double direct)
+    {
+        printf("%-16s %10.3f %10.3f %10.3f\n", name, host, direct, host - direct);
+    }
+
+    uint32_t noEvents(const clap_input_events *) { return 0; }
+}
+
+int main()
+{
+    clap_host host = {};
+    host.clap_version = CLAP_VERSION;
+
+    Wrapper * w = Wrapper::_create(&host);
+    const clap_plugin * plugin = w;
+    plugin->init(plugin);
+    plugin->activate(plugin, 48000, 1, 16);
+
+    auto * params = (const clap_plugin_params*)
+        plugin->get_extension(plugin, CLAP_EXT_PARAMS);
+
+    // short blocks, so that dispatch isn't lost in the DSP
+    float inData[16] = {}, outData[16];
+    float * inPtr = inData, * outPtr = outData;
+    clap_audio_buffer in = {}, out = {};
+    in.data32 = &inPtr; in.channel_count = 1;
+    out.data32 = &outPtr; out.channel_count = 1;
+
+    clap_input_events events = { 0, noEvents, 0 };
+    clap_process proc = {};
+    proc.frames_count = 16;
+    proc.audio_inputs = &in;
+    proc.audio_outputs = &out;
+    proc.audio_inputs_count = 1;
+    proc.audio_outputs_count = 1;
+    proc.in_events = &events;
+
+    printf("%-16s %10s %10s %10s\n", "ns/call", "host", "direct", "overhead");
+
+    report("process",
+        time_calls([&] { auto * p = opaque(plugin); p->process(p, &proc); }),
+        time_calls([&] { opaque(w)->plugin.plug_process(&proc); }));
+
+    report("get_extension",
+        time_calls([&] { auto * p = opaque(plugin);
+            opaque((void*) p->get_extension(p, CLAP_EXT_PARAMS)); }),
+        time_calls([&] {
+            opaque((void*) opaque(w)->plugin.plug_get_extension(CLAP_EXT_PARAMS)); }));
+
+    double v = 0;
+    report("params.count",
+        time_calls([&] { auto * p = opaque(plugin);
+            v += opaque(params)->count(p); }),
+        time_calls([&] { v += opaque(w)->plugin.plug_params_count(); }));
+
+    report("params.get_value",
+        time_calls([&] { auto * p = opaque(plugin); double x;
+            opaque(params)->get_value(p, 0, &x); v += x; }),
+        time_calls([&] { double x;
+            opaque(w)->plugin.plug_params_get_value(0, &x); v += x; }));
+
+    plugin->deactivate(plugin);
+    plugin->destroy(plugin);
+
+    return v < 0;   // keep v alive
+}
@@ -0,0 +1,440 @@
+
+// Headless mock host for benchmarking plugins built with the glue:
+//
+//   bench-host plugin.so [plugin-id]
+//   bench-host --lookup plugin.so
+//   bench-host --churn plugin.so
+//
+// Loads the plugin through clap_entry like a real host (init, get_factory,
+// create_plugin, init, activate, start_processing) and drives process()
+// with noise and generated event lists (alternating parameter values and
+// notes) over a matrix of block sizes, channel counts and event densities.
+// Reports time per sample (frame and channel), extra time per event and
+// heap allocations per block, counted by the allocator hooks below. The
+// host always passes one input and one output port with the channel count
+// being tested, so the plugin must cope with that. Like most hosts, the
+// audio thread runs with FTZ/DAZ set and the plugin is reset before each
+// run. Each run is repeated and the fastest is reported.
+
+#include <clap/clap.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <dlfcn.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// count allocations (from any thread) while counting is set
+extern "C"
+{
+    void * __libc_malloc(size_t);
+    void * __libc_calloc(size_t, size_t);
+    void * __libc_realloc(void *, size_t);
+    void * __libc_memalign(size_t, size_t);
+    void __libc_free(void *);
+}
+
+static std::atomic<bool>        counting = { false };
+static std::atomic<uint64_t>    allocCount = { 0 };
+
+static void count_alloc()
+{
+    if(counting.load(std::memory_order_relaxed))
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C"
+{
+    void * malloc(size_t n) { count_alloc(); return __libc_malloc(n); }
+    void * calloc(size_t n, size_t sz) { count_alloc(); return __libc_calloc(n, sz); }
+    void * realloc(void * p, size_t n) { count_alloc(); return __libc_realloc(p, n); }
+    void free(void * p) { __libc_free(p); }
+
+    void * memalign(size_t a, size_t n) { count_alloc(); return __libc_memalign(a, n); }
+    void * aligned_alloc(size_t a, size_t n) { count_alloc(); return __libc_memalign(a, n); }
+    int posix_memalign(void ** p, size_t a, size_t n)
+    {
+        count_alloc();
+        *p = __libc_memalign(a, n);
+        return *p ? 0 : ENOMEM;
+    }
+}
+
+namespace
+{
+    const clap_host_log hostLog =
+    {
+        .log = [](const clap_host *, clap_log_severity, const char * msg)
+        { fprintf(stderr, "plugin: %s\n", msg); },
+    };
+
+    const clap_host host =
+    {
+        .clap_version = CLAP_VERSION,
+        .host_data = 0,
+        .name = "bench-host",
+        .vendor = "clap-glue",
+        .url = "",
+        .version = "1",
+        .get_extension = [](const clap_host *, const char * id) -> const void *
+        { return strcmp(id, CLAP_EXT_LOG) ? 0 : &hostLog; },
+        .request_restart = [](const clap_host *) {},
+        .request_process = [](const clap_host *) {},
+        .request_callback = [](const clap_host *) {},
+    };
+
+    // time-sorted input events for one block
+    struct EventList
+    {
+        std::vector<clap_event_param_value> params;
+        std::vector<clap_event_note>        notes;
+        std::vector<const clap_event_header*>   list;
+
+        clap_input_events   in = { this, size, get };
+
+        static uint32_t size(const clap_input_events * in)
+        { return ((EventList*) in->ctx)->list.size(); }
+
+        static const clap_event_header * get(const clap_input_events * in, uint32_t i)
+        { return ((EventList*) in->ctx)->list[i]; }
+
+        // evenly spaced events, perKilo per 1024 frames of the stream
+        void generate(uint64_t pos, uint32_t frames, uint32_t perKilo, clap_id paramId)
+        {
+            params.clear(); notes.clear(); list.clear();
+            if(!perKilo) return;
+
+            // first and last event index in [pos, pos + frames)
+            uint64_t first = (pos * perKilo + 1023) / 1024;
+            uint64_t end = ((pos + frames) * perKilo + 1023) / 1024;
+            params.reserve(end - first);
+            notes.reserve(end - first);
+
+            for(uint64_t k = first; k < end; ++k)
+            {
+                uint32_t time = uint32_t(k * 1024 / perKilo - pos);
+
+                if(k & 1)
+                {
+                    clap_event_note ev = {};
+                    ev.header = { sizeof(ev), time, CLAP_CORE_EVENT_SPACE_ID,
+                        uint16_t((k & 2) ? CLAP_EVENT_NOTE_OFF : CLAP_EVENT_NOTE_ON), 0 };
+                    ev.note_id = -1; ev.port_index = 0; ev.channel = 0;
+                    ev.key = 60; ev.velocity = 1;
+                    notes.push_back(ev);
+                }
+                else
+                {
+                    clap_event_param_value ev = {};
+                    ev.header = { sizeof(ev), time, CLAP_CORE_EVENT_SPACE_ID,
+                        CLAP_EVENT_PARAM_VALUE, 0 };
+                    ev.param_id = paramId;
+                    ev.note_id = -1; ev.port_index = -1; ev.channel = -1; ev.key = -1;
+                    ev.value = (k % 7) / 7.;
+                    params.push_back(ev);
+                }
+            }
+
+            // merge back in time order, both lists are sorted
+            size_t p = 0, n = 0;
+            while(p < params.size() || n < notes.size())
+            {
+                if(n == notes.size() || (p < params.size()
+                && params[p].header.time <= notes[n].header.time))
+                    list.push_back(&params[p++].header);
+                else list.push_back(&notes[n++].header);
+            }
+        }
+    };
+
+    const clap_output_events outEvents =
+    {
+        .ctx = 0,
+        .try_push = [](const clap_output_events *, const clap_event_header *)
+        { return true; },
+    };
+
+    typedef std::chrono::steady_clock Clock;
+    
+    double ns_since(Clock::time_point t0)
+    {
+        return std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    }
+
+    struct Result
+    {
+        double      ns = 0;
+        uint64_t    samples = 0, events = 0, blocks = 0, allocs = 0;
+    };
+
+    // run blocks of the given size until about totalFrames have been processed
+    Result run(const clap_plugin * plugin, uint32_t blockSize, uint32_t nChannels,
+        uint32_t perKilo, clap_id paramId, uint64_t totalFrames)
+    {
+        std::vector<std::vector<float>> inData(nChannels), outData(nChannels);
+        std::vector<float*> inPtr(nChannels), outPtr(nChannels);
+        for(uint32_t ch = 0; ch < nChannels; ++ch)
+        {
+            inData[ch].resize(blockSize);
+            outData[ch].resize(blockSize);
+            for(auto & x : inData[ch]) x = rand() * (2.f / RAND_MAX) - 1;
+            inPtr[ch] = inData[ch].data();
+            outPtr[ch] = outData[ch].data();
+        }
+
+        clap_audio_buffer in = {}, out = {};
+        in.data32 = inPtr.data(); in.channel_count = nChannels;
+        out.data32 = outPtr.data(); out.channel_count = nChannels;
+
+        EventList events;
+
+        clap_process proc = {};
+        proc.steady_time = 0;
+        proc.frames_count = blockSize;
+        proc.audio_inputs = &in;
+        proc.audio_outputs = &out;
+        proc.audio_inputs_count = 1;
+        proc.audio_outputs_count = 1;
+        proc.in_events = &events.in;
+        proc.out_events = &outEvents;
+
+        plugin->reset(plugin);
+
+        Result r;
+        uint64_t nBlocks = (totalFrames + blockSize - 1) / blockSize;
+        uint64_t warmup = nBlocks / 16 + 1;
+
+        for(uint64_t b = 0; b < warmup + nBlocks; ++b)
+        {
+            events.generate(proc.steady_time, blockSize, perKilo, paramId);
+            bool measure = (b >= warmup);
+
+            allocCount = 0;
+            counting = measure;
+            auto t0 = Clock::now();
+            plugin->process(plugin, &proc);
+            double ns = ns_since(t0);
+            counting = false;
+
+            if(measure)
+            {
+                r.ns += ns;
+                r.samples += uint64_t(blockSize) * nChannels;
+                r.events += events.list.size();
+                r.allocs += allocCount;
+                ++r.blocks;
+            }
+            proc.steady_time += blockSize;
+        }
+        return r;
+    }
+
+    // process() over the matrix of block sizes, channels and event densities
+    int bench_process(const clap_plugin_factory * factory, const char * id)
+    {
+        const uint32_t blockSizes[] = { 32, 64, 256, 1024 };
+        const uint32_t channels[] = { 1, 2, 8 };
+        const uint32_t densities[] = { 0, 16, 256 };    // events per 1024 frames
+        const uint64_t totalFrames = 1 << 18;
+        const unsigned repeats = 5;
+
+#if defined(__SSE__)
+        _mm_setcsr(_mm_getcsr() | 0x8040);  // FTZ | DAZ
+#endif
+
+        printf("%s\n", id);
+        printf("%6s %4s %8s %11s %10s %13s\n",
+            "block", "ch", "ev/1024", "ns/sample", "ns/event", "allocs/block");
+
+        for(uint32_t blockSize : blockSizes)
+        {
+            // a fresh instance for every block size, like a host would
+            auto * plugin = factory->create_plugin(factory, &host, id);
+            if(!plugin || !plugin->init(plugin)
+            || !plugin->activate(plugin, 48000, 1, blockSize)
+            || !plugin->start_processing(plugin))
+            {
+                fprintf(stderr, "%s: failed to start\n", id);
+                return 1;
+            }
+
+            clap_id paramId = CLAP_INVALID_ID;
+            auto * params = (const clap_plugin_params*)
+                plugin->get_extension(plugin, CLAP_EXT_PARAMS);
+            clap_param_info info;
+            if(params && params->count(plugin) && params->get_info(plugin, 0, &info))
+                paramId = info.id;
+
+            for(uint32_t nCh : channels)
+            {
+                double baseNs = 0;
+                for(uint32_t perKilo : densities)
+                {
+                    Result r = run(plugin, blockSize, nCh, perKilo, paramId, totalFrames);
+                    for(unsigned i = 1; i < repeats; ++i)
+                    {
+                        Result t = run(plugin, blockSize, nCh, perKilo, paramId, totalFrames);
+                        if(t.ns < r.ns) r = t;
+                    }
+
+                    double ns = r.ns / r.blocks;
+                    if(!perKilo) baseNs = ns;
+
+                    double perEvent = r.events ? (ns - baseNs) * r.blocks / r.events : 0;
+                    printf("%6u %4u %8u %11.3f %10.1f %13.2f\n", blockSize, nCh, perKilo,
+                        r.ns / r.samples, perEvent, double(r.allocs) / r.blocks);
+                }
+            }
+
+            plugin->stop_processing(plugin);
+            plugin->deactivate(plugin);
+            plugin->destroy(plugin);
+        }
+
+        return 0;
+    }
+
+    // factory lookup with all the plugins of a bundle (see bench-lookup.cpp):
+    // freezing in init(), enumerating descriptors, create_plugin() of an
+    // unknown id and create_plugin() + destroy() of every id in random order
+    int bench_lookup(const clap_plugin_entry * entry, const char * path,
+        const clap_plugin_factory * factory)
+    {
+        entry->deinit();
+        auto t0 = Clock::now();
+        entry->init(path);
+        double initNs = ns_since(t0);
+
+        uint32_t count = factory->get_plugin_count(factory);
+        
+        std::vector<const char *> ids(count);
+        for(uint32_t i = 0; i < count; ++i)
+            ids[i] = factory->get_plugin_descriptor(factory, i)->id;
+        for(uint32_t i = count; i > 1; --i) std::swap(ids[i-1], ids[rand() % i]);
+
+        const unsigned repeats = 1 << 20;
+        
+        t0 = Clock::now();
+        uintptr_t sum = 0;
+        for(unsigned r = 0; r < repeats; ++r)
+            sum += (uintptr_t) factory->get_plugin_descriptor(factory, r % count);
+        double descNs = ns_since(t0) / repeats;
+
+        t0 = Clock::now();
+        for(unsigned r = 0; r < repeats; ++r)
+            sum += (uintptr_t) factory->create_plugin(factory, &host, "bench.unknown");
+        double missNs = ns_since(t0) / repeats;
+
+        unsigned nCreate = std::max(count, repeats / 16);
+        t0 = Clock::now();
+        for(unsigned r = 0; r < nCreate; ++r)
+        {
+            auto * plugin = factory->create_plugin(factory, &host, ids[r % count]);
+            if(!plugin) return 1;
+            plugin->destroy(plugin);
+        }
+        double createNs = ns_since(t0) / nCreate;
+
+        printf("%u plugins: init %.0f ns, get_plugin_descriptor %.1f ns,"
+            " create_plugin miss %.1f ns, create + destroy %.1f ns\n",
+            count, initNs, descNs, missNs, createNs);
+        return sum == 1;  // keep sum alive
+    }
+
+    // instance churn like project load and undo, for every plugin in the
+    // bundle: create_plugin() + init() + destroy() one at a time, then
+    // sessions of many instances destroyed in random order
+    int bench_churn(const clap_plugin_factory * factory)
+    {
+        const unsigned nSingle = 1 << 18, nSession = 256, nSessions = 256;
+        
+        printf("%-24s %12s %12s %14s\n",
+            "ns/instance", "single", "session", "allocs/inst");
+
+        std::vector<const clap_plugin*> session(nSession);
+        for(uint32_t i = 0, n = factory->get_plugin_count(factory); i < n; ++i)
+        {
+            const char * id = factory->get_plugin_descriptor(factory, i)->id;
+
+            allocCount = 0;
+            counting = true;
+            auto t0 = Clock::now();
+            for(unsigned r = 0; r < nSingle; ++r)
+            {
+                auto * plugin = factory->create_plugin(factory, &host, id);
+                if(!plugin || !plugin->init(plugin)) return 1;
+                plugin->destroy(plugin);
+            }
+            double singleNs = ns_since(t0) / nSingle;
+            counting = false;
+            double allocs = double(allocCount) / nSingle;
+
+            t0 = Clock::now();
+            for(unsigned r = 0; r < nSessions; ++r)
+            {
+                for(auto & plugin : session)
+                {
+                    plugin = factory->create_plugin(factory, &host, id);
+                    if(!plugin || !plugin->init(plugin)) return 1;
+                }
+                for(unsigned k = nSession; k > 1; --k)
+                    std::swap(session[k-1], session[rand() % k]);
+                for(auto * plugin : session) plugin->destroy(plugin);
+            }
+            double sessionNs = ns_since(t0) / (nSession * nSessions);
+
+            printf("%-24s %12.1f %12.1f %14.2f\n", id, singleNs, sessionNs, allocs);
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    const char * mode = (argc > 1 && argv[1][0] == '-') ? argv[1] : "";
+    if(*mode) { --argc; ++argv; }
+    
+    if(argc < 2 || (*mode && strcmp(mode, "--lookup") && strcmp(mode, "--churn")))
+    {
+        fprintf(stderr, "usage: bench-host [--lookup|--churn] plugin.so [plugin-id]\n");
+        return 1;
+    }
+
+    void * lib = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    if(!lib) { fprintf(stderr, "%s\n", dlerror()); return 1; }
+
+    auto * entry = (const clap_plugin_entry*) dlsym(lib, "clap_entry");
+    if(!entry || !entry->init(argv[1]))
+    {
+        fprintf(stderr, "%s: no usable clap_entry\n", argv[1]);
+        return 1;
+    }
+
+    auto * factory = (const clap_plugin_factory*)
+        entry->get_factory(CLAP_PLUGIN_FACTORY_ID);
+    if(!factory || !factory->get_plugin_count(factory))
+    {
+        fprintf(stderr, "%s: no plugins\n", argv[1]);
+        return 1;
+    }
+
+    printf("%s\n", argv[1]);
+    
+    int status = 0;
+    if(!strcmp(mode, "--lookup")) status = bench_lookup(entry, argv[1], factory);
+    else if(!strcmp(mode, "--churn")) status = bench_churn(factory);
+    else status = bench_process(factory, (argc > 2) ? argv[2]
+        : factory->get_plugin_descriptor(factory, 0)->id);
+
+    entry->deinit();
+    return status;
+}
@@ -0,0 +1,88 @@
+
+#include "clap-glue.h"
+
+#include <array>
+
+// BENCH_FACTORIES trivial plugin types in one binary, for timing the
+// factory lookup (see bench-host --lookup), built as lookup-N.so
+
+#ifndef BENCH_FACTORIES
+#define BENCH_FACTORIES 64
+#endif
+
+namespace
+{
+    const char * const features[] = { CLAP_PLUGIN_FEATURE_UTILITY, 0 };
+
+    // "bench.lookup.N" at compile time
+    template <unsigned N>
+    struct LookupId
+    {
+        static constexpr std::array<char, 24> make()
+        {
+            std::array<char, 24> s = {};
+            const char * prefix = "bench.lookup.";
+
+            unsigned i = 0;
+            while(prefix[i]) { s[i] = prefix[i]; ++i; }
+
+            unsigned div = 1;
+            while(N / div >= 10) div *= 10;
+            for(; div; div /= 10) s[i++] = char('0' + N / div % 10);
+            return s;
+        }
+
+        static constexpr std::array<char, 24> value = make();
+    };
+
+    template <unsigned N>
+    struct LookupPlugin
+    {
+        static clap_plugin_descriptor plug_desc;
+
+        LookupPlugin(const clap_host *) {}
+
+        bool plug_init() { return true; }
+        bool plug_activate(double, uint32_t, uint32_t) { return true; }
+        void plug_deactivate() {}
+        bool plug_start_processing() { return true; }
+        void plug_stop_processing() {}
+        void plug_reset() {}
+        void plug_on_main_thread() {}
+        const void * plug_get_extension(const char *) { return 0; }
+
+        clap_process_status plug_process(const clap_process *)
+        { return CLAP_PROCESS_CONTINUE; }
+    };
+
+    template <unsigned N>
+    clap_plugin_descriptor LookupPlugin<N>::plug_desc =
+    {
+        .clap_version = CLAP_VERSION,
+        .id = LookupId<N>::value.data(),
+        .name = "Lookup",
+        .vendor = "",
+        .url = "",
+        .manual_url = "",
+        .support_url = "",
+        .version = "",
+        .description = "",
+        .features = features,
+    };
+
+    // factories for [Lo, Hi), split in halves to keep the template depth low
+    template <unsigned Lo, unsigned Hi>
+    struct Factories
+    {
+        Factories<Lo, (Lo + Hi) / 2>    lo;
+        Factories<(Lo + Hi) / 2, Hi>    hi;
+    };
+
+    template <unsigned N>
+    struct Factories<N, N + 1>
+    {
+        dust::ClapFactory<LookupPlugin<N>>  factory;
+    };
+
+    Factories<0, BENCH_FACTORIES> factories;
+}
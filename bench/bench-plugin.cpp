@@ -0,0 +1,37 @@
+
+#include "bench-plugin.h"
+
+// The benchmark plugins, built into bench-plugin.so with clap-glue.cpp
+
+template <> clap_plugin_descriptor bench::BenchGainDefault::plug_desc =
+{
+    .clap_version = CLAP_VERSION,
+    .id = "bench.gain",
+    .name = "Bench Gain",
+    .vendor = "",
+    .url = "",
+    .manual_url = "",
+    .support_url = "",
+    .version = "",
+    .description = "",
+    .features = bench::features,
+};
+
+static dust::ClapFactory<bench::BenchGainDefault> gain_factory;
+
+// same plugin with pooled instances, for bench-host --churn
+template <> clap_plugin_descriptor bench::BenchGainPooled::plug_desc =
+{
+    .clap_version = CLAP_VERSION,
+    .id = "bench.gain.pooled",
+    .name = "Bench Gain (pooled)",
+    .vendor = "",
+    .url = "",
+    .manual_url = "",
+    .support_url = "",
+    .version = "",
+    .description = "",
+    .features = bench::features,
+};
+
+static dust::ClapFactory<bench::BenchGainPooled> pooled_factory;
@@ -0,0 +1,196 @@
+
+#pragma once
+
+#include "clap-glue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// A minimal glue-only plugin for the benchmarks: one parameter (gain, with
+// a one-pole smoother) applied to every channel of one audio port, plus a
+// note input that just counts notes. The allocation policy is a template
+// parameter so the same plugin can be used for the churn benchmark.
+//
+// With BENCH_NOINLINE the plug_ methods are kept out of line, so that the
+// trampolines can be checked for a plain jump (see check-trampolines.sh).
+
+#ifdef BENCH_NOINLINE
+#define BENCH_METHOD __attribute__((noinline))
+#else
+#define BENCH_METHOD
+#endif
+
+namespace bench
+{
+    inline const char * const features[] =
+    {
+        CLAP_PLUGIN_FEATURE_AUDIO_EFFECT,
+        CLAP_PLUGIN_FEATURE_UTILITY,
+        0
+    };
+
+    template <typename Alloc>
+    struct BenchGain
+    {
+        static clap_plugin_descriptor plug_desc;
+        static constexpr size_t plug_alignment = 64;
+        typedef Alloc plug_allocator;
+
+        const clap_host *host;
+        double  sampleRate = 44100;
+        float   gain = 1, target = 1, smooth = 0;
+        int     notes = 0;
+
+        BenchGain(const clap_host * h) : host(h) {}
+
+        bool plug_init() { return true; }
+
+        bool plug_activate(double sr, uint32_t, uint32_t)
+        {
+            sampleRate = sr;
+            const double pi = 3.14159265358979323846;
+            smooth = float(1 - exp(-2 * pi * 50 / sr));
+            return true;
+        }
+
+        void plug_deactivate() {}
+        bool plug_start_processing() { return true; }
+        void plug_stop_processing() {}
+        void plug_reset() { gain = target; }
+        void plug_on_main_thread() {}
+
+        const void * plug_get_extension(const char * id)
+        {
+            return dust::ClapExtensions<BenchGain,
+                dust::ClapExt_params,
+                dust::ClapExt_audio_ports,
+                dust::ClapExt_note_ports>::check(id);
+        }
+
+        BENCH_METHOD void event(const clap_event_header * ev)
+        {
+            if(ev->space_id != CLAP_CORE_EVENT_SPACE_ID) return;
+
+            if(ev->type == CLAP_EVENT_PARAM_VALUE)
+                target = ((const clap_event_param_value*) ev)->value;
+            if(ev->type == CLAP_EVENT_NOTE_ON) ++notes;
+        }
+
+        BENCH_METHOD void render(const clap_process * proc, uint32_t from, uint32_t to)
+        {
+            if(!proc->audio_inputs_count || !proc->audio_outputs_count) return;
+
+            auto & in = proc->audio_inputs[0];
+            auto & out = proc->audio_outputs[0];
+            uint32_t nCh = std::min(in.channel_count, out.channel_count);
+
+            // one smoother for all channels (and locals, so the stores
+            // don't alias the state)
+            float g = gain, t = target, k = smooth;
+            for(uint32_t i = from; i < to; ++i)
+            {
+                g += k * (t - g);
+                for(uint32_t ch = 0; ch < nCh; ++ch)
+                    out.data32[ch][i] = g * in.data32[ch][i];
+            }
+            gain = g;
+        }
+
+        BENCH_METHOD clap_process_status plug_process(const clap_process * proc)
+        {
+            auto * events = proc->in_events;
+            uint32_t nEvents = events->size(events);
+
+            uint32_t at = 0;
+            for(uint32_t i = 0; i < nEvents; ++i)
+            {
+                auto * ev = events->get(events, i);
+                uint32_t t = std::min(ev->time, proc->frames_count);
+                if(t > at) { render(proc, at, t); at = t; }
+                event(ev);
+            }
+            render(proc, at, proc->frames_count);
+
+            return CLAP_PROCESS_CONTINUE;
+        }
+
+        BENCH_METHOD uint32_t plug_params_count() { return 1; }
+
+        BENCH_METHOD bool plug_params_get_info(uint32_t index, clap_param_info * info)
+        {
+            if(index) return false;
+
+            *info = clap_param_info();
+            info->id = 0;
+            info->flags = CLAP_PARAM_IS_AUTOMATABLE;
+            strcpy(info->name, "Gain");
+            info->max_value = 1;
+            info->default_value = 1;
+            return true;
+        }
+
+        BENCH_METHOD bool plug_params_get_value(clap_id id, double * value)
+        {
+            if(id) return false;
+            *value = target;
+            return true;
+        }
+
+        BENCH_METHOD bool plug_params_value_to_text(
+            clap_id id, double value, char * txt, uint32_t size)
+        {
+            if(id) return false;
+            snprintf(txt, size, "%.2f", value);
+            return true;
+        }
+
+        BENCH_METHOD bool plug_params_text_to_value(
+            clap_id id, const char * txt, double * value)
+        {
+            if(id) return false;
+            *value = atof(txt);
+            return true;
+        }
+
+        BENCH_METHOD void plug_params_flush(
+            const clap_input_events * in, const clap_output_events *)
+        {
+            for(uint32_t i = 0, n = in->size(in); i < n; ++i) event(in->get(in, i));
+        }
+
+        uint32_t plug_audio_ports_count(bool) { return 1; }
+
+        bool plug_audio_ports_get(uint32_t index, bool isInput, clap_audio_port_info * info)
+        {
+            if(index) return false;
+
+            *info = clap_audio_port_info();
+            info->id = 0;
+            strcpy(info->name, isInput ? "In" : "Out");
+            info->flags = CLAP_AUDIO_PORT_IS_MAIN;
+            info->channel_count = 2;
+            info->port_type = CLAP_PORT_STEREO;
+            info->in_place_pair = CLAP_INVALID_ID;
+            return true;
+        }
+
+        uint32_t plug_note_ports_count(bool isInput) { return isInput ? 1 : 0; }
+
+        bool plug_note_ports_get(uint32_t index, bool isInput, clap_note_port_info * info)
+        {
+            if(index || !isInput) return false;
+
+            *info = clap_note_port_info();
+            info->id = 0;
+            info->supported_dialects = CLAP_NOTE_DIALECT_CLAP;
+            info->preferred_dialect = CLAP_NOTE_DIALECT_CLAP;
+            strcpy(info->name, "Notes");
+            return true;
+        }
+    };
+
+    typedef BenchGain<dust::ClapAllocDefault>   BenchGainDefault;
+    typedef BenchGain<dust::ClapAllocPool<>>    BenchGainPooled;
+}
@@ -0,0 +1,177 @@
+
+// ClapEventQueue (GUI to DSP, see plugin-clap.h) against the queue it
+// replaced, which copied every event through a dust::RTQueue into a
+// receive buffer. A GUI thread sends parameter values at 1k, 10k and 100k
+// events/s (in bursts every millisecond, like mouse and automation updates
+// would) while an audio thread receives every 64 frames at 48kHz, for one
+// second each. Reports the audio thread's time per block (mean and worst)
+// and per event received, the GUI thread's time per event sent and how
+// many events didn't fit. The last rows send all values to one parameter
+// inside a gesture, which ClapEventQueue coalesces.
+
+// plugin-clap.h only picks the GUI platform for Windows and macOS
+namespace dust { static const char * clap_gui_platform_api = "x11"; }
+
+#include "plugin-clap.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace
+{
+    // the previous ClapEventQueue
+    struct RTQueueEvents
+    {
+        template <typename T>
+        bool send(T & ev)
+        {
+            clap_event_header * header = &ev.header;
+            return queue.send((uint8_t*)header, header->size);
+        }
+
+        template <typename Fn> void recv(Fn && fn)
+        {
+            unsigned size = queue.recv(recv_buf, queue_size);
+            unsigned offset = 0;
+            while(offset < size)
+            {
+                auto * header = (clap_event_header*) (recv_buf + offset);
+                offset += header->size;
+                fn(header);
+            }
+        }
+
+        void setParamCount(unsigned) {}
+
+    private:
+        static const unsigned queue_size = 4096;
+
+        dust::RTQueue<uint8_t, queue_size>  queue;
+        uint8_t                             recv_buf[queue_size];
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    double ns_between(Clock::time_point t0, Clock::time_point t1)
+    {
+        return std::chrono::duration<double, std::nano>(t1 - t0).count();
+    }
+
+    const unsigned nParams = 16;
+
+    struct Result
+    {
+        double      recvNs = 0, recvMaxNs = 0, sendNs = 0;
+        uint64_t    blocks = 0, received = 0, sent = 0, dropped = 0;
+    };
+
+    template <typename Queue>
+    Result run(unsigned perSecond, bool gesture)
+    {
+        const auto duration = std::chrono::seconds(1);
+        const auto blockTime = std::chrono::microseconds(64 * 1000000 / 48000);
+        const auto burstTime = std::chrono::milliseconds(1);
+
+        auto queue = std::make_unique<Queue>();
+        queue->setParamCount(nParams);
+
+        Result r;
+        std::atomic<bool> done = { false };
+
+        std::thread dsp([&]()
+        {
+            double sum = 0;
+            auto next = Clock::now();
+            while(!done.load(std::memory_order_relaxed))
+            {
+                next += blockTime;
+                std::this_thread::sleep_until(next);
+
+                auto t0 = Clock::now();
+                queue->recv([&](const clap_event_header * header)
+                {
+                    if(header->type == CLAP_EVENT_PARAM_VALUE)
+                        sum += ((const clap_event_param_value*) header)->value;
+                    ++r.received;
+                });
+                double ns = ns_between(t0, Clock::now());
+
+                r.recvNs += ns;
+                if(ns > r.recvMaxNs) r.recvMaxNs = ns;
+                ++r.blocks;
+            }
+            if(sum < 0) printf("%f", sum);  // keep sum alive
+        });
+
+        clap_event_param_value value = {};
+        value.header = { sizeof(value), 0, CLAP_CORE_EVENT_SPACE_ID,
+            CLAP_EVENT_PARAM_VALUE, CLAP_EVENT_IS_LIVE };
+        value.note_id = -1; value.port_index = -1; value.channel = -1; value.key = -1;
+
+        clap_event_param_gesture edit = {};
+        edit.header = { sizeof(edit), 0, CLAP_CORE_EVENT_SPACE_ID,
+            CLAP_EVENT_PARAM_GESTURE_BEGIN, CLAP_EVENT_IS_LIVE };
+        edit.param_id = 0;
+        if(gesture) queue->send(edit);
+
+        unsigned perBurst = perSecond / 1000;
+        auto start = Clock::now(), next = start;
+        for(uint64_t k = 0; Clock::now() - start < duration; )
+        {
+            next += burstTime;
+            std::this_thread::sleep_until(next);
+
+            auto t0 = Clock::now();
+            for(unsigned i = 0; i < perBurst; ++i, ++k)
+            {
+                value.param_id = gesture ? 0 : k % nParams;
+                value.value = (k % 100) * .01;
+                if(!queue->send(value)) ++r.dropped;
+            }
+            r.sendNs += ns_between(t0, Clock::now());
+            r.sent += perBurst;
+        }
+
+        if(gesture)
+        {
+            edit.header.type = CLAP_EVENT_PARAM_GESTURE_END;
+            queue->send(edit);
+        }
+
+        // let the DSP take the rest
+        std::this_thread::sleep_for(4 * blockTime);
+        done = true;
+        dsp.join();
+
+        return r;
+    }
+
+    template <typename Queue>
+    void report(const char * name, unsigned perSecond, bool gesture)
+    {
+        Result r = run<Queue>(perSecond, gesture);
+
+        printf("%-24s %8u %10.1f %10.1f %10.1f %10.1f %10.2f %8llu\n",
+            name, perSecond, r.recvNs / r.blocks, r.recvMaxNs,
+            r.received ? r.recvNs / r.received : 0, r.sendNs / r.sent,
+            double(r.received) / r.blocks, (unsigned long long) r.dropped);
+    }
+}
+
+int main()
+{
+    const unsigned rates[] = { 1000, 10000, 100000 };
+
+    printf("%-24s %8s %10s %10s %10s %10s %10s %8s\n", "queue", "events/s",
+        "ns/block", "max ns", "ns/recv", "ns/send", "recv/block", "dropped");
+
+    for(unsigned rate : rates)
+    {
+        report<RTQueueEvents>("RTQueue", rate, false);
+        report<dust::ClapEventQueue>("ClapEventQueue", rate, false);
+        report<dust::ClapEventQueue>("ClapEventQueue gesture", rate, true);
+    }
+
+    return 0;
+}
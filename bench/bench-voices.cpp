@@ -0,0 +1,142 @@
+
+// Note-on/off storms through ClapVoiceManager (see plugin-clap.h) with
+// 128 voices and up. Every block gets a burst of notes on random channels
+// and keys, each followed by a note-off for an earlier note (by key or
+// by note_id, alternating), and released voices end a few blocks later
+// like a short release envelope would. There are more notes than voices,
+// so stealing runs all the time. Reports time per note event and per
+// block (walking the active voices and ending finished ones).
+
+// plugin-clap.h only picks the GUI platform for Windows and macOS
+namespace dust { static const char * clap_gui_platform_api = "x11"; }
+
+#include "plugin-clap.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double ns_since(Clock::time_point t0)
+    {
+        return std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    }
+
+    const clap_output_events outEvents =
+    {
+        .ctx = 0,
+        .try_push = [](const clap_output_events *, const clap_event_header *)
+        { return true; },
+    };
+
+    struct Result
+    {
+        double      eventNs = 0, blockNs = 0;
+        uint64_t    events = 0, blocks = 0, active = 0;
+    };
+
+    Result run(unsigned nVoices, dust::VoiceStealing stealing, unsigned notesPerBlock)
+    {
+        const unsigned nBlocks = 4096, warmup = 256, releaseBlocks = 4;
+
+        dust::ClapVoiceManager voices;
+        voices.stealing = stealing;
+        voices.activate(nVoices);
+
+        std::vector<uint64_t> endAt(nVoices, 0);
+
+        // recent notes, for note-offs
+        std::vector<clap_event_note> recent(2 * nVoices);
+        unsigned nRecent = 0;
+
+        uint32_t rng = 1;
+        auto random = [&]() { rng = rng * 1664525 + 1013904223; return rng >> 8; };
+
+        clap_event_note ev = {};
+        ev.header = { sizeof(ev), 0, CLAP_CORE_EVENT_SPACE_ID, 0, 0 };
+        ev.port_index = 0;
+        ev.velocity = 1;
+
+        Result r;
+        int32_t noteId = 0;
+        double sum = 0;
+        for(uint64_t b = 0; b < warmup + nBlocks; ++b)
+        {
+            auto t0 = Clock::now();
+            for(unsigned i = 0; i < notesPerBlock; ++i)
+            {
+                ev.header.type = CLAP_EVENT_NOTE_ON;
+                ev.note_id = noteId++;
+                ev.channel = random() % 16;
+                ev.key = random() % 128;
+                voices.noteOn(&ev, &outEvents);
+                recent[nRecent++ % recent.size()] = ev;
+
+                clap_event_note off = recent[random() % std::min<unsigned>(
+                    nRecent, recent.size())];
+                off.header.type = CLAP_EVENT_NOTE_OFF;
+                if(i & 1) off.note_id = -1;
+                else off.channel = off.key = -1;
+
+                voices.noteOff(&off, [&](int v) { endAt[v] = b + releaseBlocks; });
+            }
+            double eventNs = ns_since(t0);
+
+            t0 = Clock::now();
+            unsigned nActive = voices.count();
+            voices.forActive([&](int v)
+            {
+                sum += voices[v].velocity;
+                if(voices[v].released && endAt[v] <= b) voices.end(v, 0, &outEvents);
+            });
+            double blockNs = ns_since(t0);
+
+            if(b < warmup) continue;
+            r.eventNs += eventNs;
+            r.blockNs += blockNs;
+            r.events += 2 * notesPerBlock;
+            r.active += nActive;
+            ++r.blocks;
+        }
+
+        if(sum < 0) printf("%f", sum);  // keep sum alive
+        return r;
+    }
+}
+
+int main()
+{
+    const unsigned voiceCounts[] = { 128, 256, 1024 };
+    const unsigned notesPerBlock[] = { 16, 256 };
+    const unsigned repeats = 5;
+
+    const struct { dust::VoiceStealing mode; const char * name; } modes[] =
+    {
+        { dust::VoiceStealing::released, "released" },
+        { dust::VoiceStealing::oldest, "oldest" },
+        { dust::VoiceStealing::none, "none" },
+    };
+
+    printf("%6s %9s %11s %10s %10s %12s\n",
+        "voices", "stealing", "notes/block", "active", "ns/event", "ns/block");
+
+    for(unsigned nVoices : voiceCounts)
+    for(auto & mode : modes)
+    for(unsigned nNotes : notesPerBlock)
+    {
+        Result r = run(nVoices, mode.mode, nNotes);
+        for(unsigned i = 1; i < repeats; ++i)
+        {
+            Result t = run(nVoices, mode.mode, nNotes);
+            if(t.eventNs + t.blockNs < r.eventNs + r.blockNs) r = t;
+        }
+
+        printf("%6u %9s %11u %10.1f %10.1f %12.1f\n", nVoices, mode.name, nNotes,
+            double(r.active) / r.blocks, r.eventNs / r.events, r.blockNs / r.blocks);
+    }
+
+    return 0;
+}
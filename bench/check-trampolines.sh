@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Checks the README's claim that the ClapWrapper and ClapExt_ trampolines
+# are free: disassembles _process and ClapExt_params::_get_value from an
+# object built with the plug_ methods kept out of line (BENCH_NOINLINE)
+# and fails unless every instantiation of each is at most a this-adjustment
+# of the first argument followed by a jump (plus CET/BTI landing pads and
+# padding).
+#
+#   check-trampolines.sh object.o
+
+set -e
+
+obj="$1"
+[ -f "$obj" ] || { echo "usage: $0 object.o" >&2; exit 1; }
+
+OBJDUMP=${OBJDUMP:-objdump}
+
+dump=$($OBJDUMP -d -C --no-show-raw-insn "$obj")
+
+# checks one function, given its full (demangled) name
+check_body()
+{
+    # instructions of the function, one mnemonic and operands per line
+    body=$(printf '%s\n' "$dump" | awk -v sym="$1" '
+        /^[0-9a-f]+ <.*>:$/ {
+            name = $0
+            sub(/^[0-9a-f]+ </, "", name); sub(/>:$/, "", name)
+            inside = (name == sym); next }
+        inside && NF == 0   { inside = 0 }
+        inside              { sub(/^[ \t]*[0-9a-f]+:[ \t]*/, ""); print }')
+
+    # x86-64: adjust %rdi then jmp, aarch64: adjust x0 then b
+    extra=$(printf '%s\n' "$body" | grep -Ev \
+        -e '^(endbr64|bti|nop|xchg +%ax,%ax|data16|cs nopw)' \
+        -e '^(add|sub|lea) +[^,]*,%rdi$' \
+        -e '^(add|sub) +x0, x0, #' \
+        -e '^(jmp|b) ' || true)
+    jumps=$(printf '%s\n' "$body" | grep -Ec '^(jmp|b) ' || true)
+
+    if [ -n "$extra" ] || [ "$jumps" != 1 ]
+    then
+        echo "$1: not a plain tail-call:"
+        printf '%s\n' "$body" | sed 's/^/    /'
+        status=1
+    else
+        echo "$1: ok ($(printf '%s\n' "$body" | tr -s ' ' | paste -sd ';' -))"
+    fi
+}
+
+status=0
+for fn in ClapWrapper::_process ClapExt_params::_get_value
+do
+    # every instantiation, eg. dust::ClapWrapper<MyPlugin>::_process(...)
+    re="${fn%%::*}<.*>::${fn#*::}[(]"
+    syms=$(printf '%s\n' "$dump" | sed -n 's/^[0-9a-f]* <\(.*\)>:$/\1/p' \
+        | grep -E "$re" || true)
+
+    if [ -z "$syms" ]
+    then
+        echo "$fn: not found in $obj"
+        status=1
+        continue
+    fi
+
+    while IFS= read -r sym
+    do
+        check_body "$sym"
+    done <<END
+$syms
+END
+done
+
+exit $status
@@ -0,0 +1,71 @@
+
+#include "clap-glue.h"
+
+#include <cstdlib>
+#include <vector>
+
+// Test plugin for rtcheck-test.cpp, built with DUST_CLAP_RTCHECK (and
+// -Wl,-Bsymbolic): allocates in activate() which is fine and in process()
+// which should be reported. The plugin does nothing else about it, the
+// wrapper asks for on_main_thread() and passes violations to the host log.
+
+namespace
+{
+    const char * const features[] = { CLAP_PLUGIN_FEATURE_UTILITY, 0 };
+
+    struct RTCheckPlugin
+    {
+        static clap_plugin_descriptor plug_desc;
+
+        std::vector<float>  buffer;
+        void                *aligned = 0;
+
+        RTCheckPlugin(const clap_host *) {}
+        ~RTCheckPlugin() { free(aligned); }
+
+        bool plug_init() { return true; }
+
+        bool plug_activate(double, uint32_t, uint32_t maxFrames)
+        {
+            buffer.resize(maxFrames);
+            return true;
+        }
+
+        void plug_deactivate() {}
+        bool plug_start_processing() { return true; }
+        void plug_stop_processing() {}
+        void plug_reset() {}
+        const void * plug_get_extension(const char *) { return 0; }
+
+        clap_process_status plug_process(const clap_process * proc)
+        {
+            // a temporary that allocates (and frees)
+            std::vector<float> tmp(buffer.begin(), buffer.end());
+            buffer[0] = tmp[proc->frames_count - 1];
+
+            // and an aligned one, kept until the next block
+            free(aligned);
+            if(posix_memalign(&aligned, 64, 256)) aligned = 0;
+            
+            return CLAP_PROCESS_CONTINUE;
+        }
+
+        void plug_on_main_thread() {}
+    };
+
+    clap_plugin_descriptor RTCheckPlugin::plug_desc =
+    {
+        .clap_version = CLAP_VERSION,
+        .id = "bench.rtcheck",
+        .name = "RT check test",
+        .vendor = "",
+        .url = "",
+        .manual_url = "",
+        .support_url = "",
+        .version = "",
+        .description = "",
+        .features = features,
+    };
+
+    dust::ClapFactory<RTCheckPlugin> factory;
+}
@@ -0,0 +1,122 @@
+
+// Mock host test for the DUST_CLAP_RTCHECK guard, see rtcheck-plugin.cpp:
+//
+//   rtcheck-test rtcheck-plugin.so
+//
+// Loads the plugin like a host would (this binary links libstdc++, so the
+// plugin's allocations would bind to it without -Bsymbolic), checks that
+// nothing is reported before processing and that the allocation in
+// process() is reported afterwards. Exits non-zero on failure.
+
+#include <clap/clap.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+namespace
+{
+    std::vector<std::string>    logLines;
+    bool                        callbackRequested = false;
+
+    const clap_host_log hostLog =
+    {
+        .log = [](const clap_host *, clap_log_severity, const char * msg)
+        {
+            printf("plugin: %s\n", msg);
+            logLines.push_back(msg);
+        },
+    };
+
+    const clap_host host =
+    {
+        .clap_version = CLAP_VERSION,
+        .host_data = 0,
+        .name = "rtcheck-test",
+        .vendor = "clap-glue",
+        .url = "",
+        .version = "1",
+        .get_extension = [](const clap_host *, const char * id) -> const void *
+        { return strcmp(id, CLAP_EXT_LOG) ? 0 : &hostLog; },
+        .request_restart = [](const clap_host *) {},
+        .request_process = [](const clap_host *) {},
+        .request_callback = [](const clap_host *) { callbackRequested = true; },
+    };
+
+    unsigned count_lines(const char * what)
+    {
+        unsigned n = 0;
+        for(auto & line : logLines) if(strstr(line.c_str(), what)) ++n;
+        return n;
+    }
+
+    int fail(const char * why)
+    {
+        printf("FAIL: %s\n", why);
+        return 1;
+    }
+
+    uint32_t noEvents(const clap_input_events *) { return 0; }
+}
+
+int main(int argc, char ** argv)
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: rtcheck-test rtcheck-plugin.so\n");
+        return 1;
+    }
+
+    void * lib = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    if(!lib) return fail(dlerror());
+
+    auto * entry = (const clap_plugin_entry*) dlsym(lib, "clap_entry");
+    if(!entry || !entry->init(argv[1])) return fail("no usable clap_entry");
+
+    auto * factory = (const clap_plugin_factory*)
+        entry->get_factory(CLAP_PLUGIN_FACTORY_ID);
+    auto * plugin = factory->create_plugin(factory, &host, "bench.rtcheck");
+    if(!plugin || !plugin->init(plugin)
+    || !plugin->activate(plugin, 48000, 1, 256)
+    || !plugin->start_processing(plugin)) return fail("plugin didn't start");
+
+    // allocations outside process() are fine
+    plugin->on_main_thread(plugin);
+    if(count_lines("not in use")) return fail("hooks not in use");
+    if(count_lines("RT violation")) return fail("violation outside process()");
+
+    float inData[256] = {}, outData[256];
+    float * inPtr = inData, * outPtr = outData;
+    clap_audio_buffer in = {}, out = {};
+    in.data32 = &inPtr; in.channel_count = 1;
+    out.data32 = &outPtr; out.channel_count = 1;
+
+    clap_input_events events = { 0, noEvents, 0 };
+    clap_process proc = {};
+    proc.frames_count = 256;
+    proc.audio_inputs = &in;
+    proc.audio_outputs = &out;
+    proc.audio_inputs_count = 1;
+    proc.audio_outputs_count = 1;
+    proc.in_events = &events;
+
+    plugin->process(plugin, &proc);
+    if(!callbackRequested) return fail("no callback requested");
+    plugin->on_main_thread(plugin);
+
+    if(!count_lines("RT violation")) return fail("allocation not reported");
+    if(!count_lines(": operator new")) return fail("operator new not reported");
+    if(!count_lines(": operator delete")) return fail("operator delete not reported");
+    if(!count_lines(": posix_memalign")) return fail("posix_memalign not reported");
+
+    plugin->stop_processing(plugin);
+    plugin->deactivate(plugin);
+    plugin->destroy(plugin);
+    entry->deinit();
+
+    printf("OK: %u violations reported\n", count_lines("RT violation"));
+    return 0;
+}
@@ -1,4 +1,3 @@
-
 /* Copyright (C) 2022 pihlaja@signaldust.com, use as you please, no warranty */
 
 #include "clap-glue.h"
@@ -10,32 +9,99 @@ dust::ClapFactoryBase *
 unsigned
     dust::ClapFactoryBase::factory_count = 0;
 
+// The linked list is frozen into a table in entry_init(), so that hosts
+// enumerating and instantiating large bundles don't have to walk the list
+// (and strcmp every id) for every call. Hosts may call init/deinit more
+// than once (and from any thread), so these are counted under a mutex.
+namespace
+{
+    struct FactorySlot
+    {
+        uint32_t    hash;
+        uint32_t    index;  // index + 1, zero means empty
+    };
+
+    struct FactoryTable
+    {
+        dust::ClapFactoryBase   **list  = 0;    // in enumeration order
+        FactorySlot             *slots  = 0;    // open addressing by id hash
+        uint32_t                count   = 0;
+        uint32_t                mask    = 0;    // slot count - 1
+    } factory_table;
+
+    std::mutex  entry_mutex;
+    unsigned    entry_count = 0;    // init calls without deinit
+
+    void factory_freeze()
+    {
+        auto & t = factory_table;
+
+        t.count = dust::ClapFactoryBase::get_count();
+        t.list = new dust::ClapFactoryBase*[t.count + 1];
+
+        // keep at least half the slots empty, so probes stay short
+        uint32_t nSlots = 2;
+        while(nSlots < 2*t.count) nSlots <<= 1;
+        t.mask = nSlots - 1;
+        t.slots = new FactorySlot[nSlots]();
+
+        auto * p = dust::ClapFactoryBase::get_list();
+        for(uint32_t i = 0; i < t.count; ++i, p = p->get_next())
+        {
+            t.list[i] = p;
+
+            uint32_t h = dust::clap_hash(p->get_descriptor()->id);
+            uint32_t s = h & t.mask;
+            while(t.slots[s].index) s = (s + 1) & t.mask;
+            t.slots[s].hash = h;
+            t.slots[s].index = i + 1;
+        }
+    }
+
+    void factory_release()
+    {
+        auto & t = factory_table;
+        delete [] t.list;
+        delete [] t.slots;
+        t = FactoryTable();
+    }
+
+    dust::ClapFactoryBase * factory_find(const char * id)
+    {
+        auto & t = factory_table;
+        if(!t.slots) return 0;  // before init() or after deinit()
+        
+        uint32_t h = dust::clap_hash(id);
+        for(uint32_t s = h & t.mask; t.slots[s].index; s = (s + 1) & t.mask)
+        {
+            if(t.slots[s].hash != h) continue;
+            
+            auto * p = t.list[t.slots[s].index - 1];
+            if(!strcmp(id, p->get_descriptor()->id)) return p;
+        }
+        return 0;
+    }
+}
+
 static const clap_plugin *factory_create_plug(
     const clap_plugin_factory_t *, const clap_host *host, const char *plug_id)
 {
     if(!clap_version_is_compatible(host->clap_version)) return 0;
 
-    auto * p = dust::ClapFactoryBase::get_list();
-    while(p)
-    {
-        if(!strcmp(plug_id, p->get_descriptor()->id))
-            return p->create(host);
-        p = p->get_next();
-    }
-    return 0;
+    auto * p = factory_find(plug_id);
+    return p ? p->create(host) : 0;
 }
 
 static uint32_t factory_get_count(const clap_plugin_factory_t *)
 {
-    return dust::ClapFactoryBase::get_count();
+    return factory_table.count;
 }
 
 static const clap_plugin_descriptor_t * factory_get_desc(
     const clap_plugin_factory_t *, uint32_t i)
 {
-    auto * p = dust::ClapFactoryBase::get_list();
-    while(i--) { p = p->get_next(); }
-    return p->get_descriptor();
+    if(i >= factory_table.count) return 0;
+    return factory_table.list[i]->get_descriptor();
 }
 
 static const clap_plugin_factory_t plugin_factory =
@@ -47,9 +113,16 @@ static const clap_plugin_factory_t plugin_factory =
 
 static bool entry_init(const char *plugin_path)
 {
+    std::lock_guard<std::mutex> lock(entry_mutex);
+    if(!entry_count++) factory_freeze();
     return true;
 }
-static void entry_deinit(void) { }
+
+static void entry_deinit(void)
+{
+    std::lock_guard<std::mutex> lock(entry_mutex);
+    if(entry_count && !--entry_count) factory_release();
+}
 
 static const void *entry_get_factory(const char *factory_id)
 {
@@ -65,3 +138,259 @@ CLAP_EXPORT const clap_plugin_entry clap_entry =
     .get_factory    = entry_get_factory,
 };
 
+#ifdef DUST_CLAP_RTCHECK
+
+// Debug real-time safety checks, see ClapRTScope in clap-glue.h
+//
+// The allocator and mutex entry points are redefined here, so calls from
+// anywhere in the plugin binary (including all the inlined std:: containers
+// and std::function) go through these. For a plugin that's dlopen()ed by
+// the host this only works if the plugin is linked with -Wl,-Bsymbolic,
+// otherwise its calls bind to whatever the host has already loaded (libc
+// or libstdc++) and nothing is seen; clap_rt_report() warns if so. Calls
+// made from inside other shared libraries (eg. non-inline parts of
+// libstdc++) are not seen either way.
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <new>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+
+#ifdef __linux__
+extern "C"
+{
+    void * __libc_malloc(size_t);
+    void * __libc_calloc(size_t, size_t);
+    void * __libc_realloc(void *, size_t);
+    void * __libc_memalign(size_t, size_t);
+    void __libc_free(void *);
+}
+#endif
+
+namespace
+{
+    const unsigned rt_max_violations = 64;
+
+    std::atomic<bool>       rt_hooked = { false };  // our malloc got called
+    bool                    rt_warned = false;      // main thread
+
+    thread_local unsigned   rt_depth = 0;       // inside ClapRTScope
+    thread_local bool       rt_busy = false;    // recording, don't recurse
+
+    dust::ClapRTViolation   rt_violations[rt_max_violations];
+    std::atomic<bool>       rt_ready[rt_max_violations];
+    std::atomic<unsigned>   rt_count = { 0 };
+    unsigned                rt_reported = 0;    // main thread
+    
+    // keep the first rt_max_violations, the rest are only counted
+    void rt_violation(const char * what)
+    {
+        if(!rt_depth || rt_busy) return;
+        rt_busy = true;
+
+        unsigned i = rt_count.fetch_add(1, std::memory_order_relaxed);
+        if(i < rt_max_violations)
+        {
+            auto & v = rt_violations[i];
+            v.what = what;
+#ifdef __linux__
+            v.depth = backtrace(v.trace, 16);
+#else
+            v.depth = 0;
+#endif
+            rt_ready[i].store(true, std::memory_order_release);
+        }
+        
+        rt_busy = false;
+    }
+}
+
+dust::ClapRTScope::ClapRTScope()
+{
+#if defined(__SSE__)
+    savedCSR = _mm_getcsr();
+    _mm_setcsr(savedCSR | 0x8040);  // FTZ | DAZ
+#else
+    savedCSR = 0;
+#endif
+    ++rt_depth;
+}
+
+dust::ClapRTScope::~ClapRTScope()
+{
+#if defined(__SSE__)
+    if((_mm_getcsr() & 0x8040) != 0x8040) rt_violation("FTZ/DAZ cleared");
+    _mm_setcsr(savedCSR);
+#endif
+    --rt_depth;
+}
+
+unsigned dust::clap_rt_violation_count()
+{
+    return rt_count.load(std::memory_order_relaxed);
+}
+
+bool dust::clap_rt_hooks_active()
+{
+    return rt_hooked.load(std::memory_order_relaxed);
+}
+
+void dust::clap_rt_report(void (*log)(void * ctx, const char * txt), void * ctx)
+{
+#ifdef __linux__
+    if(!rt_warned && !clap_rt_hooks_active())
+    {
+        rt_warned = true;
+        log(ctx, "RT check: allocator hooks are not in use,"
+            " link the plugin with -Wl,-Bsymbolic");
+    }
+#endif
+    
+    unsigned n = clap_rt_violation_count();
+    if(n > rt_max_violations) n = rt_max_violations;
+    
+    char txt[256];
+    for(; rt_reported < n; ++rt_reported)
+    {
+        if(!rt_ready[rt_reported].load(std::memory_order_acquire)) break;
+        
+        auto & v = rt_violations[rt_reported];
+        snprintf(txt, sizeof(txt), "RT violation %u: %s", rt_reported, v.what);
+        log(ctx, txt);
+        
+#ifdef __linux__
+        // skip rt_violation() and the hook itself
+        char ** syms = backtrace_symbols(v.trace, v.depth);
+        for(int i = 2; syms && i < v.depth; ++i)
+        {
+            snprintf(txt, sizeof(txt), "  %s", syms[i]);
+            log(ctx, txt);
+        }
+        __libc_free(syms);  // not through our hook
+#endif
+    }
+}
+
+#ifdef __linux__
+
+namespace
+{
+    typedef int (*MutexLockFn)(pthread_mutex_t*);
+    MutexLockFn rt_mutex_lock = 0;
+
+    // resolve everything up front, both dlsym() and the first backtrace()
+    // might allocate (which would otherwise happen on the audio thread)
+    struct RTInit
+    {
+        RTInit()
+        {
+            rt_mutex_lock = (MutexLockFn) dlsym(RTLD_NEXT, "pthread_mutex_lock");
+            void * trace[1];
+            backtrace(trace, 1);
+
+            // see if our calls actually bind to our malloc
+            void * (* volatile fn)(size_t) = malloc;
+            __libc_free(fn(1));
+        }
+    } rt_init;
+}
+
+extern "C"
+{
+    void * malloc(size_t n)
+    {
+        if(!rt_hooked.load(std::memory_order_relaxed)) rt_hooked.store(true);
+        rt_violation("malloc");
+        return __libc_malloc(n);
+    }
+    
+    void * calloc(size_t n, size_t sz)
+    { rt_violation("calloc"); return __libc_calloc(n, sz); }
+    
+    void * realloc(void * p, size_t n)
+    { rt_violation("realloc"); return __libc_realloc(p, n); }
+    
+    void free(void * p)
+    { if(p) rt_violation("free"); __libc_free(p); }
+
+    void * memalign(size_t a, size_t n)
+    { rt_violation("memalign"); return __libc_memalign(a, n); }
+
+    void * aligned_alloc(size_t a, size_t n)
+    { rt_violation("aligned_alloc"); return __libc_memalign(a, n); }
+
+    int posix_memalign(void ** p, size_t a, size_t n)
+    {
+        rt_violation("posix_memalign");
+        if(!a || (a & (a - 1)) || a % sizeof(void*)) return EINVAL;
+        
+        void * mem = __libc_memalign(a, n);
+        if(!mem) return ENOMEM;
+        *p = mem;
+        return 0;
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t * m)
+    {
+        rt_violation("pthread_mutex_lock");
+        
+        // in case someone locks before our static init
+        if(!rt_mutex_lock) rt_mutex_lock =
+            (MutexLockFn) dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        return rt_mutex_lock(m);
+    }
+}
+
+// separate from malloc, since libstdc++ calls its own (unhooked) malloc
+static void * rt_new(size_t n, const char * what)
+{
+    rt_violation(what);
+    if(void * p = __libc_malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+static void * rt_new_aligned(size_t n, std::align_val_t a, const char * what)
+{
+    rt_violation(what);
+    if(void * p = __libc_memalign(size_t(a), n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+static void rt_delete(void * p, const char * what)
+{
+    if(p) rt_violation(what);
+    __libc_free(p);
+}
+
+void * operator new(size_t n) { return rt_new(n, "operator new"); }
+void * operator new[](size_t n) { return rt_new(n, "operator new[]"); }
+void * operator new(size_t n, std::align_val_t a)
+{ return rt_new_aligned(n, a, "operator new"); }
+void * operator new[](size_t n, std::align_val_t a)
+{ return rt_new_aligned(n, a, "operator new[]"); }
+
+void operator delete(void * p) noexcept { rt_delete(p, "operator delete"); }
+void operator delete[](void * p) noexcept { rt_delete(p, "operator delete[]"); }
+void operator delete(void * p, size_t) noexcept { rt_delete(p, "operator delete"); }
+void operator delete[](void * p, size_t) noexcept { rt_delete(p, "operator delete[]"); }
+void operator delete(void * p, std::align_val_t) noexcept
+{ rt_delete(p, "operator delete"); }
+void operator delete[](void * p, std::align_val_t) noexcept
+{ rt_delete(p, "operator delete[]"); }
+void operator delete(void * p, size_t, std::align_val_t) noexcept
+{ rt_delete(p, "operator delete"); }
+void operator delete[](void * p, size_t, std::align_val_t) noexcept
+{ rt_delete(p, "operator delete[]"); }
+
+#endif  // __linux__
+#endif  // DUST_CLAP_RTCHECK
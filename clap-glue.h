@@ -6,6 +6,28 @@
 #include "clap/clap.h"
 
 #include <cstring>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#ifdef DUST_CLAP_PROFILE
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#endif
+
+#ifdef DUST_CLAP_RTCHECK
+#include <cstdio>
+#endif
 
 // clap-glue.h / clap-glue.cpp
 // ---------------------------
@@ -29,21 +51,409 @@
 // when the extension is actually supported. Non-null return value can be
 // returned to the host directly, otherwise query next extension.
 //
+// Alternatively list all the supported extensions at once and let
+// ClapExtensions<MyPluginType, ClapExt_params, ...> build a lookup table
+// at compile-time (see below), which is cheaper for hosts that query
+// extensions repeatedly.
+//
 // Finally declare a non-local factory wrapper for each plugin type:
 //
 //   static ClapFactory<MyPluginType> myplug_factory;
 //
 // This will automatically register the new plugin type as one of the plugins
 // that can be instantiated by the CLAP entry point in clap-glue.cpp
+//
+// Optionally the plugin type can declare an alignment for itself and
+// an allocation policy for the wrapper (see ClapAllocPool below):
+//
+//   static constexpr size_t plug_alignment = 64;
+//   typedef ClapAllocPool<> plug_allocator;
+//
+// and hooks for base classes that need to run whatever the plugin itself
+// implements (so a plugin overriding plug_activate() can't skip them):
+//
+//   bool plug_activate_begin(sr, minFrames, maxFrames)  before plug_activate()
+//   void plug_deactivate_end()  after plug_deactivate() (or a failed activate)
+//   void plug_reset_begin()  before plug_reset()
+//   void plug_process_begin(proc)  before every plug_process()
 // 
 namespace dust
 {
+    // FNV-1a, usable at compile-time; pass the hash of a prefix
+    // as h to continue it, eg. clap_hash(b, clap_hash(a)) == hash of ab
+    constexpr uint32_t clap_hash(const char * txt, uint32_t h = 0x811c9dc5)
+    {
+        while(*txt) { h ^= (uint8_t) *txt++; h *= 0x01000193; }
+        return h;
+    }
+
+    // index of the lowest set bit, x must be non-zero
+    inline unsigned clap_bit_low(uint64_t x)
+    {
+#ifdef _MSC_VER
+        unsigned long i; _BitScanForward64(&i, x); return i;
+#else
+        return __builtin_ctzll(x);
+#endif
+    }
+
+    // index of the highest set bit, x must be non-zero
+    inline unsigned clap_bit_high(uint64_t x)
+    {
+#ifdef _MSC_VER
+        unsigned long i; _BitScanReverse64(&i, x); return i;
+#else
+        return 63 - __builtin_clzll(x);
+#endif
+    }
+
+#ifdef DUST_CLAP_PROFILE
+    // Optional process() profiler, compiled in with DUST_CLAP_PROFILE.
+    //
+    // If the plugin has a member `ClapProfile clap_profile` the wrapper
+    // times every plug_process() call into it. The audio thread is the only
+    // writer, so plain relaxed stores are enough (no locked instructions)
+    // and any thread can take a snapshot. Fields of a snapshot might be
+    // off by a block relative to each other, which is fine for statistics.
+    //
+    // Every interval seconds (of audio) the wrapper also asks the host for
+    // on_main_thread() and logs a snapshot from there.
+    struct ClapProfile
+    {
+        static const unsigned nBuckets = 32;    // log2(ns), last is overflow
+
+        // seconds of audio between logged snapshots, zero for never
+        double      interval = 10;
+        
+        struct Snapshot
+        {
+            uint64_t    blocks, frames, events, subBlocks;
+            uint64_t    totalNs, maxNs;
+            uint64_t    histogram[nBuckets];
+
+            double nsPerBlock() const { return blocks ? double(totalNs) / blocks : 0; }
+            double nsPerFrame() const { return frames ? double(totalNs) / frames : 0; }
+
+            // one line summary for logging
+            void format(char * txt, uint32_t size) const
+            {
+                snprintf(txt, size, "blocks %llu, %.1f ns/block (max %llu), "
+                    "%.2f ns/frame, %.2f events/block, %.2f sub-blocks/block",
+                    (unsigned long long) blocks, nsPerBlock(),
+                    (unsigned long long) maxNs, nsPerFrame(),
+                    blocks ? double(events) / blocks : 0,
+                    blocks ? double(subBlocks) / blocks : 0);
+            }
+        };
+
+        // audio thread
+        void record(uint64_t ns, uint32_t nFrames, uint32_t nEvents)
+        {
+            bump(blocks, 1);
+            bump(frames, nFrames);
+            bump(events, nEvents);
+            bump(totalNs, ns);
+            if(ns > maxNs.load(std::memory_order_relaxed))
+                maxNs.store(ns, std::memory_order_relaxed);
+
+            unsigned b = clap_bit_high(ns | 1);
+            bump(histogram[b < nBuckets ? b : nBuckets-1], 1);
+        }
+
+        // audio thread, called by process drivers (eg. ClapBase)
+        void addSubBlocks(uint32_t n) { bump(subBlocks, n); }
+
+        // main thread, called by the wrapper on activate
+        void activate(double sampleRate)
+        {
+            reportFrames = uint64_t(interval * sampleRate);
+            sinceReport = 0;
+        }
+
+        // audio thread, true (once) when a snapshot should be logged
+        bool reportDue(uint32_t nFrames)
+        {
+            if(!reportFrames) return false;
+            sinceReport += nFrames;
+            if(sinceReport < reportFrames) return false;
+            
+            sinceReport = 0;
+            reportPending.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        // main thread, has a snapshot been asked for since last time?
+        bool takeReport()
+        {
+            return reportPending.load(std::memory_order_relaxed)
+                && reportPending.exchange(false, std::memory_order_relaxed);
+        }
+
+        // any thread
+        Snapshot snapshot() const
+        {
+            Snapshot s;
+            s.blocks    = blocks.load(std::memory_order_relaxed);
+            s.frames    = frames.load(std::memory_order_relaxed);
+            s.events    = events.load(std::memory_order_relaxed);
+            s.subBlocks = subBlocks.load(std::memory_order_relaxed);
+            s.totalNs   = totalNs.load(std::memory_order_relaxed);
+            s.maxNs     = maxNs.load(std::memory_order_relaxed);
+            for(unsigned i = 0; i < nBuckets; ++i)
+                s.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+            return s;
+        }
+
+    private:
+        static void bump(std::atomic<uint64_t> & a, uint64_t n)
+        { a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+        std::atomic<uint64_t>   blocks = {0}, frames = {0}, events = {0};
+        std::atomic<uint64_t>   subBlocks = {0}, totalNs = {0}, maxNs = {0};
+        std::atomic<uint64_t>   histogram[nBuckets] = {};
+
+        uint64_t                reportFrames = 0, sinceReport = 0;
+        std::atomic<bool>       reportPending = { false };
+    };
+
+    // does the plugin have a ClapProfile clap_profile?
+    template <typename Plugin, typename = void>
+    struct ClapHasProfile : std::false_type {};
+    
+    template <typename Plugin>
+    struct ClapHasProfile<Plugin, std::void_t<decltype(
+        std::declval<Plugin&>().clap_profile.record(0, 0, 0))>> : std::true_type {};
+#endif
+
+#ifdef DUST_CLAP_RTCHECK
+    // Debug real-time safety checks, compiled in with DUST_CLAP_RTCHECK.
+    //
+    // The wrapper puts a ClapRTScope around plug_process() and
+    // plug_params_flush(). Inside the scope FTZ/DAZ are set (and checked
+    // on exit) and on Linux any malloc/free/operator new/delete or
+    // pthread_mutex_lock from the plugin binary is recorded along with a
+    // backtrace (see clap-glue.cpp, the plugin must be linked with
+    // -Wl,-Bsymbolic for this). Nothing is aborted, so it's safe to
+    // leave on while testing in a real host. New violations are passed
+    // to the host log (or stderr) from on_main_thread(), which the
+    // wrapper requests after the scope.
+    struct ClapRTScope
+    {
+        ClapRTScope();
+        ~ClapRTScope();
+
+    private:
+        unsigned    savedCSR;
+    };
+
+    struct ClapRTViolation
+    {
+        const char  *what;
+        void        *trace[16];
+        int         depth;
+    };
+
+    // total number of violations so far (any thread)
+    unsigned clap_rt_violation_count();
+
+    // are the allocator hooks seeing our calls (see clap-glue.cpp)?
+    bool clap_rt_hooks_active();
+    
+    // main thread: pass violations not yet reported to log(ctx, line),
+    // one line per violation and one per (symbolized) stack frame
+    void clap_rt_report(void (*log)(void * ctx, const char * txt), void * ctx);
+#endif
+
+    // does the plugin have a plug_activate_begin(sr, minFrames, maxFrames)?
+    template <typename Plugin, typename = void>
+    struct ClapHasActivateBegin : std::false_type {};
+    
+    template <typename Plugin>
+    struct ClapHasActivateBegin<Plugin, std::void_t<decltype(
+        std::declval<Plugin&>().plug_activate_begin(0., 0u, 0u))>> : std::true_type {};
+
+    // does the plugin have a plug_deactivate_end()?
+    template <typename Plugin, typename = void>
+    struct ClapHasDeactivateEnd : std::false_type {};
+    
+    template <typename Plugin>
+    struct ClapHasDeactivateEnd<Plugin, std::void_t<decltype(
+        std::declval<Plugin&>().plug_deactivate_end())>> : std::true_type {};
+
+    // does the plugin have a plug_reset_begin()?
+    template <typename Plugin, typename = void>
+    struct ClapHasResetBegin : std::false_type {};
+    
+    template <typename Plugin>
+    struct ClapHasResetBegin<Plugin, std::void_t<decltype(
+        std::declval<Plugin&>().plug_reset_begin())>> : std::true_type {};
+
+    // does the plugin have a plug_process_begin(proc)?
+    template <typename Plugin, typename = void>
+    struct ClapHasProcessBegin : std::false_type {};
+    
+    template <typename Plugin>
+    struct ClapHasProcessBegin<Plugin, std::void_t<decltype(
+        std::declval<Plugin&>().plug_process_begin(
+            (const clap_process*) 0))>> : std::true_type {};
+
+    // Default allocation policy for ClapWrapper, just aligned new/delete.
+    struct ClapAllocDefault
+    {
+        template <size_t Size, size_t Align>
+        struct Alloc
+        {
+            static void * allocate()
+            { return ::operator new(Size, std::align_val_t(Align)); }
+            
+            static void deallocate(void * p)
+            { ::operator delete(p, std::align_val_t(Align)); }
+        };
+    };
+
+    // Pooled allocation policy for ClapWrapper.
+    //
+    // Instances are carved out of slabs of (at least) SlabObjects, rounded
+    // to whole cache-lines so instances never share one, and recycled
+    // through a free-list, so churn during project load or undo doesn't go
+    // through the system allocator and recently destroyed (warm) slots are
+    // reused first. With HugePages the slabs are 2MB anonymous mappings
+    // that Linux is asked to back with transparent huge pages (elsewhere
+    // it's just a bigger slab). Slabs are released when the binary is
+    // unloaded.
+    //
+    // CLAP requires create_plugin() to be thread-safe, so the free-list is
+    // protected by a mutex (this is never used from the audio thread).
+    template <unsigned SlabObjects = 16, bool HugePages = false>
+    struct ClapAllocPool
+    {
+        static_assert(SlabObjects > 0, "empty slabs");
+        
+        template <size_t Size, size_t Align>
+        struct Alloc
+        {
+            static void * allocate()
+            {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                if(!pool.freeList) pool.refill();
+                
+                Node * n = pool.freeList;
+                pool.freeList = n->next;
+                return n;
+            }
+
+            static void deallocate(void * p)
+            {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                pool.push(p);
+            }
+
+        private:
+            struct Node { Node * next; };
+            struct Slab { Slab * next; };   // at the start of the slab
+            
+            static const size_t align = Align < 64 ? 64 : Align;
+            static const size_t stride = (Size + align - 1) & ~(align - 1);
+            static const size_t header = (sizeof(Slab) + align - 1) & ~(align - 1);
+            
+            static const size_t hugeSize = size_t(2) << 20;
+            static const size_t slabSize = HugePages
+                ? ((header + stride * SlabObjects + hugeSize - 1) & ~(hugeSize - 1))
+                : header + stride * SlabObjects;
+            static_assert(!HugePages || align <= 4096, "page aligned at most");
+
+            struct Pool
+            {
+                std::mutex  mutex;
+                Node        *freeList = 0;
+                Slab        *slabs = 0;
+
+                void push(void * p)
+                {
+                    Node * n = (Node*) p;
+                    n->next = freeList;
+                    freeList = n;
+                }
+                
+                void refill()
+                {
+                    char * mem = (char*) allocSlab();
+                    
+                    Slab * s = (Slab*) mem;
+                    s->next = slabs;
+                    slabs = s;
+                    
+                    // thread the free-list in address order
+                    size_t n = (slabSize - header) / stride;
+                    for(size_t i = n; i--;) push(mem + header + i * stride);
+                }
+                
+                static void * allocSlab()
+                {
+#ifdef __linux__
+                    if(HugePages)
+                    {
+                        void * p = mmap(0, slabSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                        if(p == MAP_FAILED) throw std::bad_alloc();
+                        madvise(p, slabSize, MADV_HUGEPAGE);
+                        return p;
+                    }
+#endif
+                    return ::operator new(slabSize, std::align_val_t(align));
+                }
+
+                ~Pool()
+                {
+                    while(slabs)
+                    {
+                        Slab * s = slabs;
+                        slabs = s->next;
+#ifdef __linux__
+                        if(HugePages) { munmap(s, slabSize); continue; }
+#endif
+                        ::operator delete(s, std::align_val_t(align));
+                    }
+                }
+            };
+
+            static inline Pool pool;
+        };
+    };
+
+    // alignment of the plugin, see plug_alignment above
+    template <typename Plugin, typename = void>
+    struct ClapPlugAlignment
+    {
+        static constexpr size_t value = alignof(Plugin);
+    };
+    
+    template <typename Plugin>
+    struct ClapPlugAlignment<Plugin, std::void_t<decltype(Plugin::plug_alignment)>>
+    {
+        static constexpr size_t value = Plugin::plug_alignment > alignof(Plugin)
+            ? Plugin::plug_alignment : alignof(Plugin);
+    };
+
+    // allocation policy of the plugin, see plug_allocator above
+    template <typename Plugin, typename = void>
+    struct ClapPlugAllocator { typedef ClapAllocDefault type; };
+    
+    template <typename Plugin>
+    struct ClapPlugAllocator<Plugin, std::void_t<typename Plugin::plug_allocator>>
+    { typedef typename Plugin::plug_allocator type; };
+
     template <typename Plugin>
     struct ClapWrapper : clap_plugin
     {
-        Plugin  plugin;
+        alignas(ClapPlugAlignment<Plugin>::value) Plugin  plugin;
+
+        const clap_host *host;
+#ifdef DUST_CLAP_RTCHECK
+        unsigned        rtSeen = 0;     // violations we've asked a report for
+#endif
 
-        ClapWrapper(const clap_host * hostPtr) : plugin(hostPtr)
+        ClapWrapper(const clap_host * hostPtr) : plugin(hostPtr), host(hostPtr)
         {
             desc                = &plugin.plug_desc;
             plugin_data         = 0;
@@ -61,20 +471,81 @@ namespace dust
 
         static ClapWrapper * _cast(const clap_plugin *self)
         { return static_cast<ClapWrapper*>(const_cast<clap_plugin*>(self)); }
+
+#ifdef DUST_CLAP_RTCHECK
+        // audio thread, at the end of a ClapRTScope
+        void _rt_poll()
+        {
+            unsigned n = clap_rt_violation_count();
+            if(n == rtSeen) return;
+            rtSeen = n;
+            host->request_callback(host);
+        }
+#endif
+
+#if defined(DUST_CLAP_RTCHECK) || defined(DUST_CLAP_PROFILE)
+        // main thread, debug reports
+        void _log(clap_log_severity severity, const char * txt)
+        {
+            auto * log = (const clap_host_log*) host->get_extension(host, CLAP_EXT_LOG);
+            if(log) log->log(host, severity, txt);
+            else fprintf(stderr, "%s\n", txt);
+        }
+#endif
+
+        // construct in storage from Plugin::plug_allocator
+        static ClapWrapper * _create(const clap_host * host)
+        {
+            typedef decltype(_allocator()) Allocator;
+            
+            void * mem = Allocator::allocate();
+            try { return new (mem) ClapWrapper(host); }
+            catch(...) { Allocator::deallocate(mem); throw; }
+        }
         
     private:
+        // the type is complete in function bodies only
+        static auto _allocator()
+        {
+            constexpr size_t size = sizeof(ClapWrapper), align = alignof(ClapWrapper);
+            return typename ClapPlugAllocator<Plugin>::type::template Alloc<size, align>();
+        }
+
         static bool _init(const clap_plugin *self)
         { return _cast(self)->plugin.plug_init(); }
         
         static void _destroy(const clap_plugin *self)
-        { delete _cast(self); }
+        {
+            auto * w = _cast(self);
+            w->~ClapWrapper();
+            decltype(_allocator())::deallocate(w);
+        }
         
         static bool _activate(const clap_plugin *self,
             double sr, uint32_t minf, uint32_t maxf)
-        { return _cast(self)->plugin.plug_activate(sr, minf, maxf); }
+        {
+            auto & plugin = _cast(self)->plugin;
+            if constexpr (ClapHasActivateBegin<Plugin>::value)
+                if(!plugin.plug_activate_begin(sr, minf, maxf)) return false;
+#ifdef DUST_CLAP_PROFILE
+            if constexpr (ClapHasProfile<Plugin>::value)
+                plugin.clap_profile.activate(sr);
+#endif
+            
+            if(plugin.plug_activate(sr, minf, maxf)) return true;
+            
+            if constexpr (ClapHasDeactivateEnd<Plugin>::value)
+                plugin.plug_deactivate_end();
+            return false;
+        }
         
         static void _deactivate(const clap_plugin *self)
-        { _cast(self)->plugin.plug_deactivate(); }
+        {
+            auto & plugin = _cast(self)->plugin;
+            plugin.plug_deactivate();
+            if constexpr (ClapHasDeactivateEnd<Plugin>::value)
+                plugin.plug_deactivate_end();
+        }
 
         static bool _start_processing(const clap_plugin *self)
         { return _cast(self)->plugin.plug_start_processing(); }
@@ -83,25 +554,87 @@ namespace dust
         { _cast(self)->plugin.plug_stop_processing(); }
 
         static void _reset(const clap_plugin *self)
-        { _cast(self)->plugin.plug_reset(); }
+        {
+            auto & plugin = _cast(self)->plugin;
+            if constexpr (ClapHasResetBegin<Plugin>::value)
+                plugin.plug_reset_begin();
+            plugin.plug_reset();
+        }
 
         static clap_process_status _process(
             const clap_plugin *self, const clap_process * proc)
-        { return _cast(self)->plugin.plug_process(proc); }
+        {
+#ifdef DUST_CLAP_RTCHECK
+            ClapRTScope rtScope;
+#endif
+            auto & plugin = _cast(self)->plugin;
+            if constexpr (ClapHasProcessBegin<Plugin>::value)
+                plugin.plug_process_begin(proc);
+#ifdef DUST_CLAP_PROFILE
+            if constexpr (ClapHasProfile<Plugin>::value)
+            {
+                typedef std::chrono::steady_clock Clock;
+                
+                auto t0 = Clock::now();
+                auto status = plugin.plug_process(proc);
+                auto t1 = Clock::now();
+
+                plugin.clap_profile.record(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count(),
+                    proc->frames_count,
+                    proc->in_events ? proc->in_events->size(proc->in_events) : 0);
+                if(plugin.clap_profile.reportDue(proc->frames_count))
+                    _cast(self)->host->request_callback(_cast(self)->host);
+#ifdef DUST_CLAP_RTCHECK
+                _cast(self)->_rt_poll();
+#endif
+                return status;
+            }
+#endif
+#ifdef DUST_CLAP_RTCHECK
+            auto status = plugin.plug_process(proc);
+            _cast(self)->_rt_poll();
+            return status;
+#else
+            return plugin.plug_process(proc);
+#endif
+        }
 
         static const void* _get_extension(const clap_plugin *self, const char * id)
         { return _cast(self)->plugin.plug_get_extension(id); }
 
         static void _on_main_thread(const clap_plugin *self)
-        { _cast(self)->plugin.plug_on_main_thread(); }
+        {
+#ifdef DUST_CLAP_RTCHECK
+            clap_rt_report([](void * ctx, const char * txt)
+            {
+                ((ClapWrapper*) ctx)->_log(CLAP_LOG_PLUGIN_MISBEHAVING, txt);
+            }, _cast(self));
+#endif
+#ifdef DUST_CLAP_PROFILE
+            if constexpr (ClapHasProfile<Plugin>::value)
+            {
+                if(_cast(self)->plugin.clap_profile.takeReport())
+                {
+                    char txt[256];
+                    _cast(self)->plugin.clap_profile.snapshot().format(txt, sizeof(txt));
+                    _cast(self)->_log(CLAP_LOG_INFO, txt);
+                }
+            }
+#endif
+            _cast(self)->plugin.plug_on_main_thread();
+        }
     };
     
     // Note ports
     template <typename Plugin>
     struct ClapExt_note_ports
     {
+        static constexpr const char * ext_id = CLAP_EXT_NOTE_PORTS;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_NOTE_PORTS)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_note_ports ext;
@@ -128,8 +661,11 @@ namespace dust
     template <typename Plugin>
     struct ClapExt_audio_ports
     {
+        static constexpr const char * ext_id = CLAP_EXT_AUDIO_PORTS;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_AUDIO_PORTS)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_audio_ports ext;
@@ -156,8 +692,11 @@ namespace dust
     template <typename Plugin>
     struct ClapExt_latency
     {
+        static constexpr const char * ext_id = CLAP_EXT_LATENCY;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_LATENCY)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_latency ext;
@@ -179,8 +718,11 @@ namespace dust
     template <typename Plugin>
     struct ClapExt_params
     {
+        static constexpr const char * ext_id = CLAP_EXT_PARAMS;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_PARAMS)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_params ext;
@@ -208,7 +750,15 @@ namespace dust
 
         static void _flush(const clap_plugin *self,
             const clap_input_events *in, const clap_output_events *out)
-        { return _cast(self)->plugin.plug_params_flush(in, out); }
+        {
+#ifdef DUST_CLAP_RTCHECK
+            ClapRTScope rtScope;
+            _cast(self)->plugin.plug_params_flush(in, out);
+            _cast(self)->_rt_poll();
+#else
+            _cast(self)->plugin.plug_params_flush(in, out);
+#endif
+        }
     };
     
     template <typename Plugin>
@@ -226,8 +776,11 @@ namespace dust
     template <typename Plugin>
     struct ClapExt_State
     {
+        static constexpr const char * ext_id = CLAP_EXT_STATE;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_STATE)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_state ext;
@@ -249,12 +802,41 @@ namespace dust
         .load = ClapExt_State<Plugin>::_load,
     };
 
+    // Tail
+    template <typename Plugin>
+    struct ClapExt_tail
+    {
+        static constexpr const char * ext_id = CLAP_EXT_TAIL;
+
+        static void * get() { return (void*) &ext; }
+        static void * check(const char * id)
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
+
+    private:
+        static const clap_plugin_tail ext;
+        
+        static ClapWrapper<Plugin> * _cast(const clap_plugin *self)
+        { return ClapWrapper<Plugin>::_cast(self); }
+        
+        static uint32_t _get(const clap_plugin *self)
+        { return _cast(self)->plugin.plug_tail_get(); }
+    };
+    
+    template <typename Plugin>
+    const clap_plugin_tail ClapExt_tail<Plugin>::ext =
+    {
+        .get    = ClapExt_tail<Plugin>::_get,
+    };
+
     // ThreadPool
     template <typename Plugin>
     struct ClapExt_thread_pool
     {
+        static constexpr const char * ext_id = CLAP_EXT_THREAD_POOL;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_THREAD_POOL)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_thread_pool ext;
@@ -263,7 +845,7 @@ namespace dust
         { return ClapWrapper<Plugin>::_cast(self); }
 
         static void _exec(const clap_plugin *self, uint32_t task_index)
-        { _cast(self)->plugin.plug_thread_pool_exec(index); }
+        { _cast(self)->plugin.plug_thread_pool_exec(task_index); }
     };
 
     template <typename Plugin>
@@ -276,8 +858,11 @@ namespace dust
     template <typename Plugin>
     struct ClapExt_note_name
     {
+        static constexpr const char * ext_id = CLAP_EXT_NOTE_NAME;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_NOTE_NAME)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_note_name ext;
@@ -304,8 +889,11 @@ namespace dust
     template <typename Plugin>
     struct ClapExt_gui
     {
+        static constexpr const char * ext_id = CLAP_EXT_GUI;
+
+        static void * get() { return (void*) &ext; }
         static void * check(const char * id)
-        { return (!strcmp(id, CLAP_EXT_GUI)) ? (void*) &ext : 0; }
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
 
     private:
         static const clap_plugin_gui ext;
@@ -381,6 +969,102 @@ namespace dust
         .hide               = ClapExt_gui<Plugin>::_hide,
     };
 
+    // VoiceInfo
+    template <typename Plugin>
+    struct ClapExt_voice_info
+    {
+        static constexpr const char * ext_id = CLAP_EXT_VOICE_INFO;
+
+        static void * get() { return (void*) &ext; }
+        static void * check(const char * id)
+        { return (!strcmp(id, ext_id)) ? get() : 0; }
+
+    private:
+        static const clap_plugin_voice_info ext;
+        
+        static ClapWrapper<Plugin> * _cast(const clap_plugin *self)
+        { return ClapWrapper<Plugin>::_cast(self); }
+
+        static bool _get(const clap_plugin *self, clap_voice_info *info)
+        { return _cast(self)->plugin.plug_voice_info_get(info); }
+    };
+
+    template <typename Plugin>
+    const clap_plugin_voice_info ClapExt_voice_info<Plugin>::ext =
+    {
+        .get    = ClapExt_voice_info<Plugin>::_get,
+    };
+
+    // Compile-time extension dispatch. Rather than chaining check() calls
+    // one can list all the supported extensions at once:
+    //
+    //   return ClapExtensions<MyPluginType,
+    //      ClapExt_params, ClapExt_audio_ports, ClapExt_gui>::check(id);
+    //
+    // Referencing the template generates both the extension tables and
+    // an open-addressing table of the extension ids hashed at compile-time,
+    // so a query costs one hash of the id and at most one strcmp.
+    template <typename Plugin, template <typename> class ... Ext>
+    struct ClapExtensions
+    {
+        static void * check(const char * id)
+        {
+            uint32_t h = clap_hash(id);
+            for(uint32_t s = h & mask; table.slot[s].get; s = (s + 1) & mask)
+            {
+                // hashes are unique within the table, see below
+                if(table.slot[s].hash != h) continue;
+                return strcmp(id, table.slot[s].id) ? 0 : table.slot[s].get();
+            }
+            return 0;
+        }
+
+    private:
+        struct Slot
+        {
+            uint32_t    hash;
+            const char  *id;
+            void*       (*get)();
+        };
+
+        static constexpr unsigned count = sizeof...(Ext);
+
+        // keep at least half the slots empty
+        static constexpr uint32_t get_size()
+        { uint32_t n = 2; while(n < 2*count) n <<= 1; return n; }
+
+        static constexpr uint32_t mask = get_size() - 1;
+
+        // extra null entry keeps this valid for an empty list
+        static constexpr Slot list[count + 1] =
+            { { clap_hash(Ext<Plugin>::ext_id), Ext<Plugin>::ext_id, Ext<Plugin>::get }... };
+
+        static constexpr bool unique_hashes()
+        {
+            for(unsigned i = 0; i < count; ++i)
+            for(unsigned j = 0; j < i; ++j)
+                if(list[i].hash == list[j].hash) return false;
+            return true;
+        }
+        static_assert(unique_hashes(), "extension id hash collision");
+
+        struct Table { Slot slot[mask + 1]; };
+
+        static constexpr Table build()
+        {
+            Table t = {};
+            for(unsigned i = 0; i < count; ++i)
+            {
+                uint32_t s = list[i].hash & mask;
+                while(t.slot[s].get) s = (s + 1) & mask;
+                t.slot[s] = list[i];
+            }
+            return t;
+        }
+
+        static constexpr Table table = build();
+    };
+
     // see ClapFactory
     struct ClapFactoryBase
     {
@@ -405,7 +1089,7 @@ namespace dust
     
     // One should declare one static factory object per plugin.
     // These automatically registers themselves into a simple list,
-    // which is then enumerated by the actual plugin entry point.
+    // which the entry point freezes into an indexed table in init().
     //
     // One should never create or destroy these dynamically.
     template <typename Plugin>
@@ -425,7 +1109,7 @@ namespace dust
         
         clap_plugin * create(const clap_host * host)
         {
-            return new ClapWrapper<Plugin>(host);
+            return ClapWrapper<Plugin>::_create(host);
         }
     };
 };
\ No newline at end of file
@@ -6,6 +6,14 @@
 #include "dust/thread/thread.h"
 #include "dust/core/hash.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
 // This wrapper implements dust-toolkit specific functionality.
 //
 // For the toolkit-independent base-wrappers, see clap-glue.h
@@ -21,6 +29,85 @@ namespace dust
     static const char * clap_gui_platform_api = CLAP_WINDOW_API_COCOA;
 #endif
 
+    enum class ParamSmoothing
+    {
+        none,       // no smoothing, just read AudioParam::value
+        linear,     // linear ramp over smoothTime
+        onepole,    // exponential approach with time-constant smoothTime
+        event,      // linear ramp reaching the target at the next event
+    };
+
+    // Minimal allocator for cache-line aligned std::vector storage.
+    template <typename T>
+    struct ClapAlignedAllocator
+    {
+        typedef T value_type;
+        static const std::size_t align = 64;
+
+        ClapAlignedAllocator() = default;
+        template <typename U>
+        ClapAlignedAllocator(const ClapAlignedAllocator<U> &) {}
+
+        T * allocate(std::size_t n)
+        { return (T*) ::operator new(n * sizeof(T), std::align_val_t(align)); }
+        void deallocate(T * p, std::size_t)
+        { ::operator delete(p, std::align_val_t(align)); }
+
+        template <typename U>
+        bool operator==(const ClapAlignedAllocator<U> &) const { return true; }
+        template <typename U>
+        bool operator!=(const ClapAlignedAllocator<U> &) const { return false; }
+    };
+
+    // Hot per-parameter state, owned by ClapBase.
+    //
+    // Everything the DSP and flush paths touch is kept here as separate
+    // cache-line aligned arrays indexed by parameter id, rather than in the
+    // AudioParam objects (which only hold the cold metadata and a handle).
+    // Parameters are added from register_param() on the main thread before
+    // activation, after which the arrays never move.
+    struct ClapParamStore
+    {
+        template <typename T>
+        using Array = std::vector<T, ClapAlignedAllocator<T>>;
+        
+        Array<float>    value;
+        Array<float>    value_default;
+        Array<uint8_t>  inGesture;      // DSP side, use setEdit() from GUI
+        Array<float>    modOffset;      // global CLAP_EVENT_PARAM_MOD amount
+
+        // smoothing state, see ClapParamSmoother
+        Array<uint8_t>  smoothMode;     // ParamSmoothing
+        Array<uint8_t>  smoothActive;
+        Array<float>    smoothTime;     // in samples
+        Array<float>    smoothTarget;
+        Array<float>    smoothCurrent;
+        Array<float>    smoothStep;     // increment or coefficient
+        Array<uint32_t> smoothRemain;   // linear ramp frames left
+
+        unsigned size() const { return value.size(); }
+
+        clap_id add(float defaultValue)
+        {
+            clap_id id = value.size();
+            
+            value.push_back(defaultValue);
+            value_default.push_back(defaultValue);
+            inGesture.push_back(false);
+            modOffset.push_back(0.f);
+
+            smoothMode.push_back((uint8_t) ParamSmoothing::none);
+            smoothActive.push_back(false);
+            smoothTime.push_back(1.f);
+            smoothTarget.push_back(defaultValue);
+            smoothCurrent.push_back(defaultValue);
+            smoothStep.push_back(0.f);
+            smoothRemain.push_back(0);
+
+            return id;
+        }
+    };
+
     // FIXME: this is early draft - at least initialization logic needs thinking
     // .. also there's the question if this should be kept free of clap-deps?
     struct AudioParam
@@ -33,51 +120,245 @@ namespace dust
         const char  *name   = "<param>";
         const char  *module = "";
 
-        // FIXME: this is a lot of useless copying, but .. idk..
-        std::function<std::string(float)>   value_to_text
-            = [](float v) { return strf("%.3f", v); };
+        // Format value straight into the host buffer (size includes the
+        // null terminator), this is used unless value_to_text is set.
+        std::function<void(float, char *, uint32_t)>    format
+            = [](float v, char * txt, uint32_t size)
+            { snprintf(txt, size, "%.3f", v); };
+
+        // Legacy alternative to format (allocates), empty by default.
+        std::function<std::string(float)>   value_to_text;
             
         std::function<float(const char *)>  text_to_value
             = [](const char * txt) { return parseNumeric(txt); };
 
+        // Memoize recent value <-> text conversions (see ClapTextCache),
+        // which helps when the host redraws automation lanes and such.
+        // Only enable if the conversions depend on the value alone.
+        bool    cacheText = false;
+
         // these are for GUI to call
         std::function<void(bool)>   setEdit = [](bool) { assert(false); };
         std::function<void(float)>  setValue = [](float) { assert(false); };
 
-        bool        inGesture = false;  // DSP side, use setEdit() from GUI
-        
-        float       value           = .5f;
+        // GUI side, bumped by ClapBase::update_gui_params() when the value
+        // has changed, so controls need only compare with the last seen
+        unsigned    guiSerial = 0;
+
+        // accept CLAP_EVENT_PARAM_MOD (globally, per note_id or per key),
+        // read the result with ClapBase::modulated()
+        bool        modulatable = false;
+
+        // initial value, copied into the ClapParamStore by register_param
         float       value_default   = .5f;
 
-        // helper
+        // stable key for plug_state_save/load (ids depend on registration
+        // order), eg. clap_hash("gain"); must be unique or plug_init() fails;
+        // zero uses the name instead, clap_hash("module/name") (or just
+        // "name" without a module), so renaming loses the saved value
+        uint32_t    stateKey    = 0;
+
+        // handle into ClapParamStore, filled by register_param
+        ClapParamStore  *store = 0;
+
+        float getValue() const { return store->value[id]; }
+        bool getInGesture() const { return store->inGesture[id]; }
+
+        // see ClapParamSmoother, read with ClapBase::smoothed()
+        ParamSmoothing  smoothing   = ParamSmoothing::none;
+        float           smoothTime  = 20.f; // in milliseconds
+
+        // helper: parse a decimal number (eg. "-1.5e3 dB"), ignoring any
+        // trailing garbage; doesn't allocate and doesn't depend on locale
         static float parseNumeric(const char * txt)
-        { float v; sscanf(txt, "%f", &v); return v; }
+        {
+            while(*txt == ' ' || *txt == '\t') ++txt;
+
+            bool neg = (*txt == '-');
+            if(*txt == '-' || *txt == '+') ++txt;
+
+            // accumulate up to 19 significant digits as an integer
+            uint64_t mant = 0;
+            int digits = 0, exp10 = 0;
+            for(; *txt >= '0' && *txt <= '9'; ++txt)
+            {
+                if(digits < 19) { mant = mant*10 + (*txt - '0'); if(mant) ++digits; }
+                else ++exp10;
+            }
+            if(*txt == '.')
+            {
+                for(++txt; *txt >= '0' && *txt <= '9'; ++txt)
+                {
+                    if(digits < 19)
+                    {
+                        mant = mant*10 + (*txt - '0'); --exp10;
+                        if(mant) ++digits;
+                    }
+                }
+            }
+            if((*txt == 'e' || *txt == 'E') && mant)
+            {
+                const char * e = txt + 1;
+                bool eneg = (*e == '-');
+                if(*e == '-' || *e == '+') ++e;
+                
+                int x = 0;
+                for(; *e >= '0' && *e <= '9'; ++e) if(x < 1000) x = x*10 + (*e - '0');
+                exp10 += eneg ? -x : x;
+            }
+
+            double v = (double) mant;
+            double scale = 10.;
+            for(int x = exp10 < 0 ? -exp10 : exp10; x; x >>= 1)
+            {
+                if(x & 1) v = (exp10 < 0) ? v / scale : v * scale;
+                scale *= scale;
+            }
+            return float(neg ? -v : v);
+        }
+    };
+
+    // Small direct-mapped memo cache for parameter text conversions,
+    // created by ClapBase::register_param when AudioParam::cacheText is set.
+    struct ClapTextCache
+    {
+        static const unsigned nEntries = 16;     // power of two
+        static const unsigned textSize = 48;
+
+        // returns false on miss
+        bool getText(float v, char * txt, uint32_t size)
+        {
+            auto & e = toText[hashValue(v)];
+            if(!e.valid || e.value != v) return false;
+            
+            copyText(txt, e.text, size);
+            return true;
+        }
+
+        void putText(float v, const char * txt)
+        {
+            if(strlen(txt) >= textSize) return;
+            
+            auto & e = toText[hashValue(v)];
+            e.valid = true; e.value = v;
+            strcpy(e.text, txt);
+        }
+
+        bool getValue(const char * txt, float & v)
+        {
+            auto & e = toValue[hashText(txt)];
+            if(!e.valid || strcmp(e.text, txt)) return false;
+
+            v = e.value;
+            return true;
+        }
+
+        void putValue(const char * txt, float v)
+        {
+            if(strlen(txt) >= textSize) return;
+            
+            auto & e = toValue[hashText(txt)];
+            e.valid = true; e.value = v;
+            strcpy(e.text, txt);
+        }
+
+        static void copyText(char * dst, const char * src, uint32_t size)
+        {
+            if(!size) return;
+            
+            uint32_t n = 0;
+            while(n + 1 < size && src[n]) { dst[n] = src[n]; ++n; }
+            dst[n] = 0;
+        }
+
+    private:
+        struct Entry
+        {
+            bool    valid = false;
+            float   value = 0;
+            char    text[textSize];
+        };
+
+        Entry   toText[nEntries];
+        Entry   toValue[nEntries];
+        
+        static unsigned hashValue(float v)
+        {
+            uint32_t bits; memcpy(&bits, &v, sizeof(bits));
+            return (bits * 0x9e3779b1u) >> 28;
+        }
+        
+        static unsigned hashText(const char * txt)
+        {
+            return clap_hash(txt) & (nEntries - 1);
+        }
     };
 
     // This is mostly for internal GUI -> DSP use below.
+    //
+    // Single-producer, single-consumer ring of variable-length records.
+    // Events are never split across the end of the buffer (the remaining
+    // space is skipped with a padding record instead), so the consumer can
+    // walk them in place and the space is only released after the walk.
+    //
+    // With coalesce set, a value event for a parameter in a gesture that
+    // still has an earlier value waiting in the queue just replaces that
+    // value in place when sent, so a knob being dragged while the host is
+    // slow to flush takes a single record and only the latest value is
+    // received. The last reserveBytes of the queue are only used by other
+    // events, so gesture begin/end events are never dropped because of
+    // values (or reordered).
     struct ClapEventQueue
     {
+        // set before the queue is in use
+        bool    coalesce = true;
+
+        // statistics, can be read from any thread
+        uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+        uint64_t getCoalesced() const { return coalesced.load(std::memory_order_relaxed); }
+        
+        // set the number of parameters for coalescing, main thread only
+        void setParamCount(unsigned n)
+        {
+            gestureState.resize(n, false);
+            lastValue.resize(n, noValue);
+        }
+        
         // Send event
         template <typename T>
         bool send(T & ev)
         {
             clap_event_header * header = &ev.header;   // typecheck
-            return queue.send((uint8_t*)header, header->size);
+            return push(header);
         }
 
         // Receive all events from the GUI
-        template <typename Fn> void recv(Fn && fn) { recv(fn); }
-        template <typename Fn> void recv(Fn & fn)
+        template <typename Fn> void recv(Fn && fn)
         {
-            unsigned size = queue.recv(recv_buf, queue_size);
-            unsigned offset = 0;
-            while(offset < size)
+            uint32_t head = writePos.load(std::memory_order_acquire);
+            uint32_t tail = readPos.load(std::memory_order_relaxed);
+
+            while(tail != head)
             {
-                auto * header = (clap_event_header*) (recv_buf + offset);
-                offset += header->size;
+                auto * rec = (Record*) (buffer + (tail & (queue_size-1)));
+                tail += rec->size;
+                
+                if(rec->flags & Record::padding) continue;
+
+                auto * header = (clap_event_header*) (rec + 1);
+                if(rec->flags & Record::value)
+                {
+                    // take the latest value, the sender can't replace it now
+                    uint64_t bits = rec->latest.exchange(
+                        Record::taken, std::memory_order_acquire);
+                    memcpy(&((clap_event_param_value*) header)->value,
+                        &bits, sizeof(bits));
+                }
+                
                 fn(header);
             }
-            // assert(size == offset);
+
+            readPos.store(tail, std::memory_order_release);
         }
 
         // helper
@@ -128,201 +409,2314 @@ namespace dust
         }
 
     private:
-        static const unsigned queue_size = 4096;
+        static const unsigned queue_size = 4096;    // must be power of two
+        static const unsigned reserveBytes = 512;   // not used by values
+
+        struct Record
+        {
+            enum { padding = 1, value = 2 };
+            static const uint64_t taken = ~uint64_t(0);
+            
+            uint32_t    size;   // including this header and alignment
+            uint32_t    flags;
+
+            // bits of the value (double) for value records, replaced by the
+            // sender while coalescing until the receiver marks it taken
+            std::atomic<uint64_t>   latest;
+        };
+
+        bool push(const clap_event_header * header)
+        {
+            uint32_t head = writePos.load(std::memory_order_relaxed);
+            uint32_t tail = readPos.load(std::memory_order_acquire);
+
+            // parameter id if this is a value (or gesture) event we track
+            clap_id id = ~0u;
+            bool isValue = false;
+            if(coalesce && header->space_id == CLAP_CORE_EVENT_SPACE_ID)
+            {
+                if(header->type == CLAP_EVENT_PARAM_VALUE)
+                {
+                    id = ((const clap_event_param_value*) header)->param_id;
+                    isValue = true;
+                }
+                if(header->type == CLAP_EVENT_PARAM_GESTURE_BEGIN
+                || header->type == CLAP_EVENT_PARAM_GESTURE_END)
+                    id = ((const clap_event_param_gesture*) header)->param_id;
+                if(id >= lastValue.size()) { id = ~0u; isValue = false; }
+            }
+
+            uint64_t bits = 0;
+            if(isValue)
+            {
+                double v = ((const clap_event_param_value*) header)->value;
+                memcpy(&bits, &v, sizeof(bits));
+            }
+
+            // replace the last value of the gesture if it's still queued
+            // (records aren't reused until the receiver has released them)
+            if(isValue && gestureState[id] && lastValue[id] != noValue
+            && int32_t(lastValue[id] - tail) >= 0)
+            {
+                auto * rec = (Record*) (buffer + (lastValue[id] & (queue_size-1)));
+                uint64_t old = rec->latest.load(std::memory_order_relaxed);
+                while(old != Record::taken)
+                {
+                    if(rec->latest.compare_exchange_weak(old, bits,
+                        std::memory_order_release, std::memory_order_relaxed))
+                    {
+                        coalesced.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+            }
+            
+            // keep records 16-byte aligned, so padding always has room
+            // for a header (and the events are 8-byte aligned)
+            uint32_t size = (sizeof(Record) + header->size + 15) & ~15u;
+            
+            // if the record doesn't fit before the end, skip to the start
+            uint32_t at = head & (queue_size-1);
+            uint32_t pad = (at + size > queue_size) ? queue_size - at : 0;
+
+            uint32_t limit = isValue ? queue_size - reserveBytes : queue_size;
+            if(head + pad + size - tail > limit)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            
+            if(pad)
+            {
+                new (buffer + at) Record { pad, Record::padding, { 0 } };
+                head += pad; at = 0;
+            }
+
+            new (buffer + at) Record {
+                size, isValue ? uint32_t(Record::value) : 0u, { bits } };
+            memcpy(buffer + at + sizeof(Record), header, header->size);
+
+            // never coalesce across gesture boundaries
+            if(id != ~0u)
+            {
+                if(!isValue) gestureState[id]
+                    = (header->type == CLAP_EVENT_PARAM_GESTURE_BEGIN);
+                lastValue[id] = isValue ? head : noValue;
+            }
+
+            writePos.store(head + size, std::memory_order_release);
+            return true;
+        }
+
+        // sender side coalescing state, by parameter id
+        static constexpr uint32_t noValue = ~0u;
+        std::vector<bool>       gestureState;
+        std::vector<uint32_t>   lastValue;      // queue position of last value
+
+        std::atomic<uint64_t>   dropped = { 0 };
+        std::atomic<uint64_t>   coalesced = { 0 };
+        
+        // free-running positions, masked on access
+        alignas(64) std::atomic<uint32_t>   writePos = { 0 };
+        alignas(64) std::atomic<uint32_t>   readPos = { 0 };
         
-        RTQueue<uint8_t, queue_size>    queue;
-        uint8_t                         recv_buf[queue_size];
+        alignas(64) uint8_t                 buffer[queue_size];
     };
 
-    // Some basic stuff ...
+    // Per-sample smoothing of parameter values, owned by ClapBase.
     //
-    // Eventually this should probably implement some basic parameter handling?
+    // Every parameter with smoothing enabled gets a buffer of max_frames
+    // values that is filled for each sub-block by process_events(). Once a
+    // parameter settles its buffer is left holding the target value and
+    // it is skipped until the value changes again, so only the parameters
+    // that are actually moving cost anything.
     //
-    struct ClapBase : WindowDelegate
+    // The ramps are computed in closed form (per parameter) so that the
+    // inner loops are straight-line arithmetic the compiler can vectorize.
+    // The smoothing state itself lives in the ClapParamStore.
+    struct ClapParamSmoother
     {
-        // Extension interfaces that we currently make use of..
-        struct {
-            const clap_host         *host;
-            const clap_host_params  *host_params;
-            const clap_host_gui     *host_gui;
-        } clap = {};
+        // allocate buffers, called from ClapBase::plug_activate_begin
+        void activate(ClapParamStore & paramStore,
+            std::vector<AudioParam*> & params,
+            double sampleRate, uint32_t maxFrames)
+        {
+            store = &paramStore;
+            
+            // pad buffers to whole cache-lines
+            stride = (maxFrames + 15) & ~15u;
+            
+            slotOf.assign(params.size(), -1);
+            unsigned nSlots = 0;
+            
+            for(auto * p : params)
+            {
+                store->smoothMode[p->id] = (uint8_t) p->smoothing;
+                store->smoothActive[p->id] = false;
+                
+                if(p->smoothing == ParamSmoothing::none) continue;
 
-        struct {
-            // Names of ports - first one is always main
-            // FIXME: might want to specify more stuff (eg. nChannels?)
-            std::vector<const char*>    audioIn;
-            std::vector<const char*>    audioOut;
-        } properties;
+                slotOf[p->id] = nSlots++;
+                store->smoothTime[p->id] =
+                    std::max(1.f, float(p->smoothTime * .001 * sampleRate));
+            }
 
-        Panel           plug_editor;    // Top level plug_editor Panel; use as a parent.
-        ClapEventQueue  gui_to_dsp;     // GUI to DSP event queue
+            active.clear(); active.reserve(nSlots);
+            
+            storage.assign(nSlots * stride + 16, 0.f);
+            buffers = (float*) ((uintptr_t(storage.data()) + 63) & ~uintptr_t(63));
 
-        // short-hand for requesting flush
-        void flush_events()
+            for(auto * p : params)
+            {
+                if(slotOf[p->id] >= 0) snap(p->id, store->value[p->id]);
+            }
+        }
+
+        // jump to a value without smoothing
+        void snap(clap_id id, float v)
         {
-            if(clap.host_params) clap.host_params->request_flush(clap.host);
+            store->smoothTarget[id] = store->smoothCurrent[id] = v;
+            store->smoothRemain[id] = 0;
+            fill(buffer(id), v, 0, stride);
         }
 
-        void register_param(AudioParam & param)
+        // start moving towards a new target value
+        void retarget(clap_id id, float v)
         {
-            auto * p = &param;
+            if(id >= slotOf.size() || slotOf[id] < 0) return;
+            
+            auto & s = *store;
+            if(v == s.smoothTarget[id]) return;
+            s.smoothTarget[id] = v;
 
-            p->id = plug_params.size();
-            plug_params.push_back(p);
+            switch((ParamSmoothing) s.smoothMode[id])
+            {
+            case ParamSmoothing::linear:
+                s.smoothRemain[id] = (uint32_t) s.smoothTime[id];
+                s.smoothStep[id] = (v - s.smoothCurrent[id]) / s.smoothRemain[id];
+                break;
+            case ParamSmoothing::onepole:
+                s.smoothStep[id] = expf(-1.f / s.smoothTime[id]);
+                break;
+            case ParamSmoothing::event:
+                s.smoothRemain[id] = pendingEvent;   // length known in run()
+                break;
+            default: break;
+            }
 
-            p->setEdit = [this, p] (bool b)
-            { gui_to_dsp.setParamEditState(*p, b); flush_events(); };
+            if(!s.smoothActive[id])
+            {
+                s.smoothActive[id] = true;
+                active.push_back(id);
+            }
+        }
+
+        // compute the next sub-block for all moving parameters
+        void run(uint32_t frames)
+        {
+            for(unsigned i = 0; i < active.size();)
+            {
+                clap_id id = active[i];
+                bool done = (store->smoothMode[id] == (uint8_t) ParamSmoothing::onepole)
+                    ? runOnePole(id, frames) : runLinear(id, frames);
+
+                if(!done) { ++i; continue; }
+
+                // settled, skip this one until it changes again
+                store->smoothCurrent[id] = store->smoothTarget[id];
+                store->smoothActive[id] = false;
+                active[i] = active.back(); active.pop_back();
+            }
+        }
+
+        const float * get(clap_id id) const
+        {
+            assert(id < slotOf.size() && slotOf[id] >= 0);
+            return buffers + slotOf[id]*stride;
+        }
+
+    private:
+        static constexpr uint32_t pendingEvent = ~0u;
+
+        float * buffer(clap_id id) { return buffers + slotOf[id]*stride; }
+        
+        static void fill(float * buf, float v, uint32_t from, uint32_t to)
+        { for(uint32_t i = from; i < to; ++i) buf[i] = v; }
+
+        bool runLinear(clap_id id, uint32_t frames)
+        {
+            auto & s = *store;
+            float * buf = buffer(id);
+
+            // ramp to the start of the next sub-block
+            if(s.smoothRemain[id] == pendingEvent)
+            {
+                s.smoothRemain[id] = frames;
+                s.smoothStep[id] = (s.smoothTarget[id] - s.smoothCurrent[id]) / frames;
+            }
+            
+            uint32_t n = std::min(s.smoothRemain[id], frames);
+            float v0 = s.smoothCurrent[id], dv = s.smoothStep[id];
+            for(uint32_t i = 0; i < n; ++i) buf[i] = v0 + dv * float(i+1);
+
+            s.smoothCurrent[id] = v0 + dv * float(n);
+            s.smoothRemain[id] -= n;
+            if(s.smoothRemain[id]) return false;
+
+            // stay active for one more sub-block to overwrite the ramp
+            fill(buf, s.smoothTarget[id], n, stride);
+            return !n;
+        }
+        
+        bool runOnePole(clap_id id, uint32_t frames)
+        {
+            auto & s = *store;
+            float * buf = buffer(id);
+            
+            float t = s.smoothTarget[id], a = s.smoothStep[id];
+            float d = s.smoothCurrent[id] - t;
+            
+            // four lanes at a time: d*a^1 .. d*a^4
+            float k[4] = { a, a*a, a*a*a, a*a*a*a };
+            uint32_t i = 0;
+            for(; i + 4 <= frames; i += 4)
+            {
+                for(int j = 0; j < 4; ++j) buf[i+j] = t + d * k[j];
+                d *= k[3];
+            }
+            for(; i < frames; ++i) { d *= a; buf[i] = t + d; }
+            
+            s.smoothCurrent[id] = t + d;
+            if(fabsf(d) > 1e-6f) return false;
+
+            // close enough that overwriting the whole buffer is inaudible
+            fill(buf, t, 0, stride);
+            return true;
+        }
+
+        ClapParamStore              *store = 0;
+        
+        std::vector<clap_id>        active;     // parameters currently moving
+        std::vector<int>            slotOf;     // buffer index by param id
+
+        std::vector<float>          storage;
+        float                       *buffers = 0;   // aligned into storage
+        uint32_t                    stride = 0;
+    };
+
+    // Per-voice parameter modulation table, owned by ClapBase.
+    //
+    // Each voice (ie. note_id with modulation) gets a slot holding one
+    // amount per modulatable parameter. Slots are found from note_id with
+    // a small open-addressing hash, so the render path can look up its
+    // slot once and then read the amounts directly. Everything is
+    // allocated on activate; when all slots are taken, new voices simply
+    // don't get per-voice modulation.
+    struct ClapVoiceMod
+    {
+        void activate(std::vector<AudioParam*> & params, unsigned maxVoices)
+        {
+            colOf.assign(params.size(), -1);
+            nCols = 0;
+            for(auto * p : params) if(p->modulatable) colOf[p->id] = nCols++;
+
+            nSlots = maxVoices;
+            noteOf.assign(nSlots, -1);
+            amounts.assign(nSlots * nCols, 0.f);
+
+            // keep at least half the buckets empty
+            unsigned nBuckets = 2;
+            while(nBuckets < 2*nSlots) nBuckets <<= 1;
+            bucketMask = nBuckets - 1;
+            buckets.assign(nBuckets, -1);
+
+            freeSlots.clear();
+            for(unsigned i = nSlots; i--;) freeSlots.push_back(i);
+        }
+
+        // returns -1 if the note has no per-voice modulation
+        int find(int32_t note_id) const
+        {
+            if(buckets.empty()) return -1;
+            
+            for(unsigned b = hash(note_id);; b = (b + 1) & bucketMask)
+            {
+                int slot = buckets[b];
+                if(slot < 0 || noteOf[slot] == note_id) return slot;
+            }
+        }
+
+        void set(int32_t note_id, clap_id id, float amount)
+        {
+            if(id >= colOf.size() || colOf[id] < 0) return;
+            
+            int slot = find(note_id);
+            if(slot < 0)
+            {
+                if(freeSlots.empty()) return;
+                slot = freeSlots.back(); freeSlots.pop_back();
+
+                noteOf[slot] = note_id;
+                for(unsigned i = 0; i < nCols; ++i) amounts[slot*nCols + i] = 0.f;
+                
+                unsigned b = hash(note_id);
+                while(buckets[b] >= 0) b = (b + 1) & bucketMask;
+                buckets[b] = slot;
+            }
+            amounts[slot*nCols + colOf[id]] = amount;
+        }
+
+        void release(int32_t note_id)
+        {
+            if(buckets.empty()) return;
+            
+            unsigned b = hash(note_id);
+            while(buckets[b] >= 0 && noteOf[buckets[b]] != note_id)
+                b = (b + 1) & bucketMask;
+            if(buckets[b] < 0) return;
+
+            freeSlots.push_back(buckets[b]);
+            noteOf[buckets[b]] = -1;
+            buckets[b] = -1;
+
+            // backward-shift the rest of the cluster, no tombstones
+            for(unsigned i = (b + 1) & bucketMask;
+                buckets[i] >= 0; i = (i + 1) & bucketMask)
+            {
+                unsigned home = hash(noteOf[buckets[i]]);
+                if(((i - home) & bucketMask) < ((i - b) & bucketMask)) continue;
+                
+                buckets[b] = buckets[i];
+                buckets[i] = -1;
+                b = i;
+            }
+        }
+
+        // drop all per-voice amounts, doesn't allocate
+        void clear()
+        {
+            std::fill(noteOf.begin(), noteOf.end(), -1);
+            std::fill(buckets.begin(), buckets.end(), -1);
+
+            freeSlots.clear();
+            for(unsigned i = nSlots; i--;) freeSlots.push_back(i);
+        }
+
+        float get(int slot, clap_id id) const
+        {
+            if(slot < 0 || colOf[id] < 0) return 0.f;
+            return amounts[slot*nCols + colOf[id]];
+        }
+
+    private:
+        unsigned hash(int32_t note_id) const
+        { return (uint32_t(note_id) * 0x9e3779b1u >> 16) & bucketMask; }
+        
+        std::vector<int>        colOf;      // by param id
+        unsigned                nCols = 0;
+        unsigned                nSlots = 0;
+
+        std::vector<int32_t>    noteOf;     // by slot
+        std::vector<float>      amounts;    // [slot][column]
+        std::vector<int>        freeSlots;
+
+        std::vector<int>        buckets;    // slot by note_id hash
+        unsigned                bucketMask = 0;
+    };
+
+    enum class VoiceStealing
+    {
+        none,       // ignore new notes when all voices are in use
+        oldest,     // steal the oldest voice
+        released,   // steal the oldest released voice, else the oldest
+    };
+
+    struct ClapVoice
+    {
+        int32_t     note_id     = -1;
+        int16_t     port_index  = -1;
+        int16_t     channel     = -1;
+        int16_t     key         = -1;
+        double      velocity    = 0;
+        
+        bool        released    = false;    // note-off received
+        uint64_t    age         = 0;        // note-on serial
+    };
+
+    // Fixed-capacity polyphonic voice allocator, owned by ClapBase.
+    //
+    // The pool is allocated in plug_activate() with properties.maxVoices
+    // and nothing allocates after that. Voices are indices into the pool,
+    // so the plugin can keep its own per-voice DSP state in parallel arrays.
+    // Note events are matched by note_id, or by channel/key through a small
+    // per-key index, with -1 as a wildcard as per the CLAP spec.
+    //
+    // Typical use from the process_events() event callback:
+    //
+    //   NOTE_ON:   v = voices.noteOn(ev, out); then start voice v
+    //   NOTE_OFF:  voices.noteOff(ev, [](int v) { ...start release... });
+    //   finished:  voices.end(v, time, out);  (sends CLAP_EVENT_NOTE_END)
+    struct ClapVoiceManager
+    {
+        VoiceStealing   stealing = VoiceStealing::released;
+
+        // called with the note_id of every voice that ends (or is stolen)
+        std::function<void(int32_t)>    onEnd = [](int32_t) {};
+        
+        void activate(unsigned maxVoices)
+        {
+            voices.assign(maxVoices, ClapVoice());
+            activeList.clear(); activeList.reserve(maxVoices);
+            activePos.assign(maxVoices, -1);
+
+            keyHead.assign(nKeys, -1);
+            keyNext.assign(maxVoices, -1);
+            keyPrev.assign(maxVoices, -1);
+            
+            freeList.clear(); freeList.reserve(maxVoices);
+            for(unsigned i = maxVoices; i--;) freeList.push_back(i);
+        }
+
+        unsigned capacity() const { return voices.size(); }
+        unsigned count() const { return activeList.size(); }
+
+        ClapVoice & operator[](int v) { return voices[v]; }
+
+        // call fn(v) for every active voice
+        template <typename Fn> void forActive(Fn && fn)
+        {
+            // iterate backwards so fn() can end() the voice
+            for(unsigned i = activeList.size(); i--;) fn(activeList[i]);
+        }
+
+        // allocate a voice, stealing one if necessary (-1 if none)
+        int noteOn(const clap_event_note * ev, const clap_output_events * out)
+        {
+            if(freeList.empty() && !steal(ev->header.time, out)) return -1;
+            
+            int v = freeList.back(); freeList.pop_back();
+            
+            auto & voice = voices[v];
+            voice.note_id = ev->note_id;
+            voice.port_index = ev->port_index;
+            voice.channel = ev->channel;
+            voice.key = ev->key;
+            voice.velocity = ev->velocity;
+            voice.released = false;
+            voice.age = ++serial;
+
+            activePos[v] = activeList.size();
+            activeList.push_back(v);
+            
+            if(int k = keyIndex(voice); k >= 0)
+            {
+                keyNext[v] = keyHead[k]; keyPrev[v] = -1;
+                if(keyHead[k] >= 0) keyPrev[keyHead[k]] = v;
+                keyHead[k] = v;
+            }
+
+            return v;
+        }
+
+        // mark matching voices released, calling fn(v) for each
+        template <typename Fn>
+        void noteOff(const clap_event_note * ev, Fn && fn)
+        {
+            match(ev, [&](int v)
+            {
+                if(voices[v].released) return;
+                voices[v].released = true;
+                fn(v);
+            });
+        }
+
+        // end matching voices immediately, calling fn(v) for each first
+        template <typename Fn>
+        void choke(const clap_event_note * ev,
+            const clap_output_events * out, Fn && fn)
+        {
+            match(ev, [&](int v)
+            {
+                fn(v);
+                end(v, ev->header.time, out);
+            });
+        }
+
+        // call fn(v) for all active voices matching note_id, port_index,
+        // channel and key (-1 is wildcard), fn() may end() the voice
+        template <typename Fn>
+        void match(int32_t note_id, int16_t port_index,
+            int16_t channel, int16_t key, Fn && fn)
+        {
+            clap_event_note ev = {};
+            ev.note_id = note_id; ev.port_index = port_index;
+            ev.channel = channel; ev.key = key;
+            match(&ev, fn);
+        }
+
+        // voice has finished, release it and send CLAP_EVENT_NOTE_END
+        void end(int v, uint32_t time, const clap_output_events * out)
+        {
+            if(activePos[v] < 0) return;
+            auto & voice = voices[v];
+
+            if(out)
+            {
+                clap_event_note ev =
+                {
+                    .header = {
+                        .size = sizeof(ev),
+                        .time = time,
+                        .space_id = CLAP_CORE_EVENT_SPACE_ID,
+                        .type = CLAP_EVENT_NOTE_END,
+                        .flags = 0,
+                    },
+                    .note_id = voice.note_id,
+                    .port_index = voice.port_index,
+                    .channel = voice.channel,
+                    .key = voice.key,
+                    .velocity = 0,
+                };
+                out->try_push(out, &ev.header);
+            }
+            
+            onEnd(voice.note_id);
+
+            // swap-remove from the active list
+            int last = activeList.back();
+            activeList[activePos[v]] = last;
+            activePos[last] = activePos[v];
+            activeList.pop_back();
+            activePos[v] = -1;
+
+            if(int k = keyIndex(voice); k >= 0)
+            {
+                if(keyPrev[v] >= 0) keyNext[keyPrev[v]] = keyNext[v];
+                else keyHead[k] = keyNext[v];
+                if(keyNext[v] >= 0) keyPrev[keyNext[v]] = keyPrev[v];
+            }
+
+            voice = ClapVoice();
+            freeList.push_back(v);
+        }
+
+    private:
+        static const int nKeys = 16*128;
+        
+        static int keyIndex(const ClapVoice & voice)
+        {
+            if(voice.channel < 0 || voice.channel > 15
+            || voice.key < 0 || voice.key > 127) return -1;
+            return voice.channel*128 + voice.key;
+        }
+        
+        bool steal(uint32_t time, const clap_output_events * out)
+        {
+            if(stealing == VoiceStealing::none || activeList.empty()) return false;
+
+            int best = -1;
+            for(int v : activeList)
+            {
+                if(best < 0) { best = v; continue; }
+                
+                bool vRel = voices[v].released, bRel = voices[best].released;
+                if(stealing == VoiceStealing::released && vRel != bRel)
+                {
+                    if(vRel) best = v;
+                    continue;
+                }
+                if(voices[v].age < voices[best].age) best = v;
+            }
+
+            end(best, time, out);
+            return true;
+        }
+
+        // call fn(v) for all active voices matching ev (-1 is wildcard)
+        template <typename Fn>
+        void match(const clap_event_note * ev, Fn && fn)
+        {
+            auto matches = [&](const ClapVoice & voice)
+            {
+                return (ev->note_id == -1 || ev->note_id == voice.note_id)
+                    && (ev->port_index == -1 || ev->port_index == voice.port_index)
+                    && (ev->channel == -1 || ev->channel == voice.channel)
+                    && (ev->key == -1 || ev->key == voice.key);
+            };
+
+            // fast path through the key index
+            if(ev->channel >= 0 && ev->channel < 16
+            && ev->key >= 0 && ev->key < 128)
+            {
+                int v = keyHead[ev->channel*128 + ev->key];
+                while(v >= 0)
+                {
+                    int next = keyNext[v];  // fn() might end() the voice
+                    if(matches(voices[v])) fn(v);
+                    v = next;
+                }
+                return;
+            }
+
+            for(unsigned i = activeList.size(); i--;)
+            {
+                int v = activeList[i];
+                if(matches(voices[v])) fn(v);
+            }
+        }
+
+        std::vector<ClapVoice>  voices;
+        
+        std::vector<int>        activeList; // indices of voices in use
+        std::vector<int>        activePos;  // position in activeList or -1
+        std::vector<int>        freeList;
+
+        // voices by channel/key as doubly linked lists
+        std::vector<int>        keyHead;
+        std::vector<int>        keyNext;
+        std::vector<int>        keyPrev;
+
+        uint64_t                serial = 0;
+    };
+
+    // Fallback worker threads for ClapBase::parallel_exec() when the host
+    // doesn't provide a thread-pool (or refuses to run the tasks).
+    //
+    // Workers spin (yielding) for a while after each job so back-to-back
+    // blocks get picked up quickly, then back off to short sleeps so idle
+    // instances don't burn a core each. The calling thread takes tasks too.
+    struct ClapWorkerPool
+    {
+        typedef void (*Task)(void * ctx, uint32_t index);
+
+        ~ClapWorkerPool() { stop(); }
+
+        void start(unsigned nThreads)
+        {
+            stop();
+            quit.store(false);
+            for(unsigned i = 0; i < nThreads; ++i)
+                threads.emplace_back([this]() { threadMain(); });
+        }
+
+        void stop()
+        {
+            quit.store(true);
+            for(auto & t : threads) t.join();
+            threads.clear();
+        }
+
+        // run task(ctx, i) for all i < nTasks, returns when all are done
+        void run(uint32_t nTasks, Task task, void * ctx)
+        {
+            if(threads.empty() || !nTasks)
+            {
+                for(uint32_t i = 0; i < nTasks; ++i) task(ctx, i);
+                return;
+            }
+            assert(nTasks <= fieldMask);
+
+            job.task = task; job.ctx = ctx;
+            done.store(0, std::memory_order_relaxed);
+
+            // new generation, task index zero; publishes the job
+            generation = (generation + 1) & genMask;
+            next.store((uint64_t(generation) << 40) | (uint64_t(nTasks) << 20),
+                std::memory_order_release);
+
+            work(generation);
+            while(done.load(std::memory_order_acquire) < nTasks)
+                std::this_thread::yield();
+        }
+
+    private:
+        // The job state is packed as generation:count:index so that a late
+        // worker can never take a task from a newer job. Once the index is
+        // claimed (with index < count) the job can't be finished, so the
+        // caller can't be rewriting the task and context.
+        static const uint64_t fieldMask = (1 << 20) - 1;
+        static const uint32_t genMask = (1 << 24) - 1;
+
+        void work(uint32_t gen)
+        {
+            uint64_t v = next.load(std::memory_order_acquire);
+            for(;;)
+            {
+                uint32_t index = v & fieldMask, count = (v >> 20) & fieldMask;
+                if((v >> 40) != gen || index >= count) return;
+                
+                if(!next.compare_exchange_weak(v, v + 1,
+                    std::memory_order_acquire)) continue;
+
+                job.task(job.ctx, index);
+                done.fetch_add(1, std::memory_order_release);
+                v = next.load(std::memory_order_acquire);
+            }
+        }
+
+        void threadMain()
+        {
+            uint32_t seen = 0;
+            unsigned idle = 0;
+            
+            while(!quit.load(std::memory_order_relaxed))
+            {
+                uint32_t gen = uint32_t(next.load(std::memory_order_acquire) >> 40);
+                if(gen != seen)
+                {
+                    seen = gen; idle = 0;
+                    work(gen);
+                    continue;
+                }
+
+                if(++idle < spinLimit) std::this_thread::yield();
+                else std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+
+        static const unsigned spinLimit = 20000;
+
+        struct
+        {
+            Task        task = 0;
+            void        *ctx = 0;
+        } job;
+        uint32_t        generation = 0;     // caller side copy
+        
+        alignas(64) std::atomic<uint64_t>   next = { 0 };   // gen:count:index
+        alignas(64) std::atomic<uint32_t>   done = { 0 };
+        std::atomic<bool>                   quit = { false };
+
+        std::vector<std::thread>            threads;
+    };
+
+    // Audio buffers for one sub-block of ClapBase::process_audio(), with
+    // the channel pointers offset to the start of the sub-block. T is the
+    // sample type of the host buffers (float or double).
+    template <typename T>
+    struct ClapAudioBlock
+    {
+        const clap_process  *proc;
+        uint32_t            offset;     // from the start of the host block
+        uint32_t            frames;
+
+        uint32_t nInputs() const { return proc->audio_inputs_count; }
+        uint32_t nOutputs() const { return proc->audio_outputs_count; }
+
+        uint32_t nInChannels(uint32_t port) const
+        { return proc->audio_inputs[port].channel_count; }
+        uint32_t nOutChannels(uint32_t port) const
+        { return proc->audio_outputs[port].channel_count; }
+
+        const T * in(uint32_t port, uint32_t ch) const
+        { return data(proc->audio_inputs[port])[ch] + offset; }
+        
+        T * out(uint32_t port, uint32_t ch) const
+        { return data(proc->audio_outputs[port])[ch] + offset; }
+
+        static T ** data(const clap_audio_buffer & buf)
+        {
+            if constexpr (std::is_same<T, double>::value) return buf.data64;
+            else return buf.data32;
+        }
+    };
+
+    // Double-buffered heavy DSP state (eg. wavetables or sample maps),
+    // use ClapSharedState<T> below and ClapBase::register_shared_state().
+    //
+    // A new object is built off the audio thread and published (eg. from
+    // a ClapBase::register_state_chunk() loader), then the DSP picks it up
+    // with a pointer swap at the start of the next block and the old one
+    // is deleted on the main thread (ClapBase asks the host for a callback).
+    // Nothing is ever allocated or freed by the DSP.
+    struct ClapSharedStateBase
+    {
+        // DSP side: take the pending object if any, returns true if the
+        // old one should be reclaimed; keeps the old object if the last
+        // retired one hasn't been reclaimed yet (retry next block)
+        bool swap()
+        {
+            if(!pending.load(std::memory_order_relaxed)
+            || retired.load(std::memory_order_acquire)) return false;
+            
+            void * p = pending.exchange(0, std::memory_order_acquire);
+            if(!p) return false;
+
+            if(current) retired.store(current, std::memory_order_release);
+            current = p;
+            return true;
+        }
+
+        // main thread: delete the retired object if any
+        void reclaim()
+        {
+            if(void * p = retired.exchange(0, std::memory_order_acquire)) destroy(p);
+        }
+
+    protected:
+        ClapSharedStateBase(void (*d)(void*)) : destroy(d) {}
+        ~ClapSharedStateBase()
+        {
+            destroy(current);
+            destroy(pending.load());
+            destroy(retired.load());
+        }
+
+        void publish(void * p)
+        {
+            // replaced before the DSP ever saw it, so we can delete here
+            if(void * old = pending.exchange(p, std::memory_order_acq_rel)) destroy(old);
+        }
+
+        void                *current = 0;   // DSP side
+        std::atomic<void*>  pending = { 0 };
+        std::atomic<void*>  retired = { 0 };
+
+    private:
+        void (*destroy)(void*);
+    };
+
+    template <typename T>
+    struct ClapSharedState : ClapSharedStateBase
+    {
+        ClapSharedState()
+            : ClapSharedStateBase([](void * p) { delete (T*) p; }) {}
+
+        // DSP side, valid for the whole block (null until first publish)
+        T * get() const { return (T*) current; }
+
+        // Main thread (or a single loader thread), takes ownership; the
+        // object should be fully prepared, it's not touched again here.
+        void publish(std::unique_ptr<T> p)
+        { ClapSharedStateBase::publish(p.release()); }
+    };
+
+    // Serializer for ClapBase::plug_state_save().
+    //
+    // Everything is collected into memory first (so section sizes can be
+    // patched in afterwards) and then written to the host stream in as few
+    // calls as the host allows. Values are stored little-endian.
+    struct ClapStateWriter
+    {
+        void put(const void * src, uint32_t n)
+        {
+            auto * p = (const uint8_t*) src;
+            data.insert(data.end(), p, p + n);
+        }
+
+        void putU32(uint32_t v)
+        {
+            uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8),
+                uint8_t(v >> 16), uint8_t(v >> 24) };
+            put(b, 4);
+        }
+
+        void putF32(float v)
+        {
+            uint32_t u; memcpy(&u, &v, 4);
+            putU32(u);
+        }
+
+        // tagged section, returns a handle for endSection()
+        size_t beginSection(uint32_t tag)
+        {
+            putU32(tag);
+            putU32(0);  // size, patched by endSection
+            return data.size();
+        }
+
+        void endSection(size_t at)
+        {
+            uint32_t n = data.size() - at;
+            for(int i = 0; i < 4; ++i) data[at - 4 + i] = uint8_t(n >> (8*i));
+        }
+
+        // the host might accept less than we give it, so loop
+        bool write(const clap_ostream * stream)
+        {
+            for(size_t pos = 0; pos < data.size();)
+            {
+                int64_t n = stream->write(stream, data.data() + pos, data.size() - pos);
+                if(n <= 0) return false;
+                pos += n;
+            }
+            return true;
+        }
+
+        std::vector<uint8_t>    data;
+    };
+
+    // Buffered deserializer for ClapBase::plug_state_load().
+    //
+    // Reads the host stream in large blocks (looping on short reads) and
+    // serves small values from the buffer. Inside a section, reads past
+    // the end of the section fail, so a chunk loader can't run into the
+    // next section no matter what the data says.
+    struct ClapStateReader
+    {
+        // properties.stateVersion of the plugin that saved the state
+        uint32_t    version = 0;
+
+        ClapStateReader(const clap_istream * s) : stream(s) {}
+
+        bool get(void * dst, uint64_t n)
+        {
+            if(n > limit) return false;
+            limit -= n;
+
+            auto * p = (uint8_t*) dst;
+            while(n)
+            {
+                // bypass the buffer for large reads
+                if(pos == end && n >= sizeof(buffer))
+                {
+                    int64_t r = stream->read(stream, p, n);
+                    if(r <= 0) return false;
+                    p += r; n -= r;
+                    continue;
+                }
+
+                if(pos == end && !fill()) return false;
+
+                uint32_t c = std::min<uint64_t>(n, end - pos);
+                memcpy(p, buffer + pos, c);
+                pos += c; p += c; n -= c;
+            }
+            return true;
+        }
+
+        bool getU32(uint32_t & v)
+        {
+            uint8_t b[4];
+            if(!get(b, 4)) return false;
+            v = b[0] | (b[1] << 8) | (b[2] << 16) | (uint32_t(b[3]) << 24);
+            return true;
+        }
+
+        bool getF32(float & v)
+        {
+            uint32_t u;
+            if(!getU32(u)) return false;
+            memcpy(&v, &u, 4);
+            return true;
+        }
+
+        bool skip(uint64_t n)
+        {
+            if(n > limit) return false;
+            limit -= n;
+
+            while(n)
+            {
+                if(pos == end && !fill()) return false;
+
+                uint32_t c = std::min<uint64_t>(n, end - pos);
+                pos += c; n -= c;
+            }
+            return true;
+        }
+
+        // bytes left in the current section
+        uint64_t remaining() const { return limit; }
+
+        // used by ClapBase, skips whatever the section loader didn't read
+        void beginSection(uint32_t size) { limit = size; }
+        bool endSection()
+        {
+            bool ok = skip(limit);
+            limit = ~uint64_t(0);
+            return ok;
+        }
+
+    private:
+        bool fill()
+        {
+            int64_t r = stream->read(stream, buffer, sizeof(buffer));
+            if(r <= 0) return false;    // end of stream or error
+            pos = 0; end = r;
+            return true;
+        }
+
+        const clap_istream  *stream;
+
+        uint64_t    limit = ~uint64_t(0);    // unlimited outside sections
+
+        uint32_t    pos = 0, end = 0;
+        uint8_t     buffer[4096];
+    };
+
+    // Linear-phase half-band FIR for 2x resampling (see ClapOversampler).
+    //
+    // The prototype has 4K-1 taps centered at M = 2K-1, where every other
+    // tap is zero apart from the center (which is 1/2). Only the 2K non-zero
+    // even taps are stored, the center tap is just a delay. The latency is
+    // M samples at the higher rate.
+    struct ClapHalfBand
+    {
+        std::vector<float>  coef;   // h[2j], j < 2K
+        uint32_t            K = 0;
+
+        static constexpr double pi = 3.14159265358979323846;
+
+        // windowed sinc with a 4-term Blackman-Harris window
+        void design(uint32_t halfLength)
+        {
+            K = halfLength;
+            coef.resize(2*K);
+
+            double M = 2*K - 1, N = 4*K, sum = 0;
+            for(uint32_t j = 0; j < 2*K; ++j)
+            {
+                double t = (2*j - M) * .5;  // always half-integer
+                double x = 2 * pi * (2*j + 1) / N;
+                double w = .35875 - .48829 * cos(x)
+                    + .14128 * cos(2*x) - .01168 * cos(3*x);
+                
+                coef[j] = sin(pi * t) / (pi * t) * w;
+                sum += coef[j];
+            }
+            
+            // unity gain at DC, including the center tap
+            for(auto & c : coef) c *= .5 / sum;
+        }
+    };
+
+    // Cascade of half-band stages for 2^n times oversampling, used by
+    // ClapBase::process_oversampled().
+    //
+    // Each stage filters a whole block at once, one tap at a time over all
+    // samples (rather than one sample at a time over all taps), so the inner
+    // loops are plain multiply-adds that vectorize without reassociation.
+    // The first stage sees the most critical transition band, so later
+    // stages get away with much shorter filters.
+    struct ClapOversampler
+    {
+        static constexpr uint32_t maxLog2 = 4;  // 16x
+
+        // main thread, while inactive; channels are at most the given
+        void setup(uint32_t nInputs, uint32_t nOutputs, uint32_t maxFrames, uint32_t log2)
+        {
+            factorLog2 = std::min(log2, maxLog2);
+            padding = (latency(factorLog2) << factorLog2) - filterLatency(factorLog2);
+            
+            stages.resize(factorLog2);
+            for(uint32_t s = 0; s < factorLog2; ++s) stages[s].design(stageK(s));
+
+            uint32_t maxHigh = maxFrames << factorLog2;
+            
+            inputs.resize(nInputs);
+            for(auto & c : inputs) c.setup(stages, maxFrames, false);
+            outputs.resize(nOutputs);
+            for(auto & c : outputs)
+            {
+                c.setup(stages, maxFrames, true);
+                c.pad.assign(padding + maxHigh, 0.f);
+            }
+
+            acc.assign(maxHigh / 2 + 1, 0.f);
+        }
+
+        void reset()
+        {
+            for(auto & c : inputs) c.reset();
+            for(auto & c : outputs) c.reset();
+        }
+
+        uint32_t factor() const { return 1 << factorLog2; }
+
+        // half-length of the filter for stage s
+        static uint32_t stageK(uint32_t s) { return s == 0 ? 24 : s == 1 ? 8 : 4; }
+
+        // Total up + down latency for a factor in base rate samples. The
+        // filters alone give a fractional latency from the second stage on,
+        // so the outputs get an extra delay at the high rate to round it up.
+        static uint32_t latency(uint32_t log2)
+        {
+            log2 = std::min(log2, maxLog2);
+            return (filterLatency(log2) + (1 << log2) - 1) >> log2;
+        }
+
+        // high rate buffers of each channel, valid after up()
+        float * input(uint32_t ch) { return inputs[ch].high(factorLog2); }
+        float * output(uint32_t ch) { return outputs[ch].high(factorLog2); }
+
+        // in high rate samples
+        static uint32_t filterLatency(uint32_t log2)
+        {
+            uint32_t l = 0;
+            for(uint32_t s = 0; s < log2; ++s) l += (2*stageK(s) - 1) << (log2 - s);
+            return l;
+        }
+
+        // frames at the base rate, writes factor()*frames to input(ch)
+        template <typename T>
+        void up(uint32_t ch, const T * in, uint32_t frames)
+        {
+            auto & c = inputs[ch];
+
+            float * x = c.work[0].data();
+            for(uint32_t i = 0; i < frames; ++i) x[i] = float(in[i]);
+            
+            for(uint32_t s = 0; s < factorLog2; ++s)
+            {
+                upStage(stages[s], c.state[s][0], c.work[s].data(),
+                    c.work[s+1].data(), frames << s);
+            }
+        }
+
+        // reads factor()*frames from output(ch), writes frames
+        template <typename T>
+        void down(uint32_t ch, T * out, uint32_t frames)
+        {
+            auto & c = outputs[ch];
+
+            // round up the latency to whole base rate samples
+            if(padding)
+            {
+                uint32_t n = frames << factorLog2;
+                float * hi = c.high(factorLog2), * p = c.pad.data();
+                memcpy(p + padding, hi, n * sizeof(float));
+                memcpy(hi, p, n * sizeof(float));
+                memmove(p, p + n, padding * sizeof(float));
+            }
+
+            for(uint32_t s = factorLog2; s--;)
+            {
+                downStage(stages[s], c.state[s][0], c.state[s][1],
+                    c.work[s+1].data(), c.work[s].data(), frames << s);
+            }
+            
+            const float * y = c.work[0].data();
+            for(uint32_t i = 0; i < frames; ++i) out[i] = T(y[i]);
+        }
+        
+    private:
+        typedef std::vector<float, ClapAlignedAllocator<float>> Buffer;
+        
+        struct Channel
+        {
+            // work[s] holds the signal at 2^s times the base rate
+            std::vector<Buffer>                 work;
+            // history buffers per stage, plus block space after it
+            std::vector<std::array<Buffer,2>>   state;
+            // output delay line, see latency()
+            Buffer                              pad;
+            
+            float * high(uint32_t log2) { return work[log2].data(); }
+
+            void setup(std::vector<ClapHalfBand> & stages, uint32_t maxFrames, bool down)
+            {
+                work.resize(stages.size() + 1);
+                for(uint32_t s = 0; s <= stages.size(); ++s)
+                    work[s].assign(maxFrames << s, 0.f);
+
+                // up: 2K-1 input history; down: 2K-1 even, K odd history
+                state.resize(stages.size());
+                for(uint32_t s = 0; s < stages.size(); ++s)
+                {
+                    uint32_t K = stages[s].K, n = maxFrames << s;
+                    state[s][0].assign(2*K - 1 + n, 0.f);
+                    state[s][1].assign(down ? K + n : 0, 0.f);
+                }
+            }
+
+            void reset()
+            {
+                for(auto & st : state) for(auto & b : st)
+                    std::fill(b.begin(), b.end(), 0.f);
+                std::fill(pad.begin(), pad.end(), 0.f);
+            }
+        };
+
+        // x[n] -> y[2n]
+        //   y[2i]   = 2 * sum_j h[2j] x[i-j]
+        //   y[2i+1] = x[i-(K-1)]
+        void upStage(const ClapHalfBand & hb, Buffer & hist,
+            const float * x, float * y, uint32_t n)
+        {
+            uint32_t K = hb.K, L = 2*K - 1;
+            
+            float * b = hist.data() + L;
+            memcpy(b, x, n * sizeof(float));
+
+            float * a = acc.data();
+            for(uint32_t i = 0; i < n; ++i) a[i] = 0.f;
+            for(uint32_t j = 0; j < 2*K; ++j)
+            {
+                const float c = 2 * hb.coef[j];
+                const float * bj = b - j;
+                for(uint32_t i = 0; i < n; ++i) a[i] += c * bj[i];
+            }
+
+            const float * d = b - (K - 1);
+            for(uint32_t i = 0; i < n; ++i)
+            {
+                y[2*i] = a[i];
+                y[2*i+1] = d[i];
+            }
+            
+            memmove(hist.data(), hist.data() + n, L * sizeof(float));
+        }
+
+        // v[2n] -> y[n], with e[i] = v[2i] and o[i] = v[2i+1]
+        //   y[i] = sum_j h[2j] e[i-j] + o[i-K]/2
+        void downStage(const ClapHalfBand & hb, Buffer & even, Buffer & odd,
+            const float * v, float * y, uint32_t n)
+        {
+            uint32_t K = hb.K, L = 2*K - 1;
+            
+            float * e = even.data() + L;
+            float * o = odd.data() + K;
+            for(uint32_t i = 0; i < n; ++i)
+            {
+                e[i] = v[2*i];
+                o[i] = v[2*i+1];
+            }
+
+            const float * d = o - K;
+            for(uint32_t i = 0; i < n; ++i) y[i] = .5f * d[i];
+            for(uint32_t j = 0; j < 2*K; ++j)
+            {
+                const float c = hb.coef[j];
+                const float * ej = e - j;
+                for(uint32_t i = 0; i < n; ++i) y[i] += c * ej[i];
+            }
+            
+            memmove(even.data(), even.data() + n, L * sizeof(float));
+            memmove(odd.data(), odd.data() + n, K * sizeof(float));
+        }
+
+        std::vector<ClapHalfBand>   stages;
+        std::vector<Channel>        inputs, outputs;
+        Buffer                      acc;    // upStage() temporary
+        uint32_t                    factorLog2 = 0;
+        uint32_t                    padding = 0;    // high rate samples
+    };
+
+    // Oversampled sub-block for ClapBase::process_oversampled(), with the
+    // same interface as ClapAudioBlock (so render can be written once for
+    // both), but always float and with frames at the oversampled rate.
+    struct ClapOversampledBlock
+    {
+        ClapOversampler     *os;
+        const clap_process  *proc;
+        uint32_t            offset;     // oversampled frames from block start
+        uint32_t            frames;
+        uint32_t            inPorts, outPorts;
+
+        uint32_t nInputs() const { return inPorts; }
+        uint32_t nOutputs() const { return outPorts; }
+
+        // ports are stereo (see ClapBase::plug_audio_ports_get), but the
+        // host might still pass fewer channels
+        uint32_t nInChannels(uint32_t port) const
+        { return std::min(proc->audio_inputs[port].channel_count, 2u); }
+        uint32_t nOutChannels(uint32_t port) const
+        { return std::min(proc->audio_outputs[port].channel_count, 2u); }
+
+        const float * in(uint32_t port, uint32_t ch) const
+        { return os->input(port*2 + ch); }
+        
+        float * out(uint32_t port, uint32_t ch) const
+        { return os->output(port*2 + ch); }
+    };
+
+    // Fixed size block for ClapBase::process_fixed(), again with the same
+    // interface as ClapAudioBlock. Channels are consecutive in one buffer,
+    // all inputs first, then all outputs.
+    template <typename T>
+    struct ClapFixedBlock
+    {
+        T                   *data;
+        const clap_process  *proc;
+        uint32_t            offset;     // always zero
+        uint32_t            frames;     // properties.fixedBlockSize
+        uint32_t            inPorts, outPorts;
+        uint32_t            fifoInPorts;    // input ports in data
+
+        uint32_t nInputs() const { return inPorts; }
+        uint32_t nOutputs() const { return outPorts; }
+
+        // ports are stereo (see ClapBase::plug_audio_ports_get), but the
+        // host might still pass fewer channels
+        uint32_t nInChannels(uint32_t port) const
+        { return std::min(proc->audio_inputs[port].channel_count, 2u); }
+        uint32_t nOutChannels(uint32_t port) const
+        { return std::min(proc->audio_outputs[port].channel_count, 2u); }
+
+        const T * in(uint32_t port, uint32_t ch) const
+        { return data + (port*2 + ch) * frames; }
+        
+        T * out(uint32_t port, uint32_t ch) const
+        { return data + ((fifoInPorts + port)*2 + ch) * frames; }
+    };
+
+    // Bump-pointer scratch memory for the audio thread, owned by ClapBase.
+    //
+    // Reserved once on activate, then allocations just move a pointer and
+    // everything is released at once by reset() or back to a mark().
+    struct ClapScratchArena
+    {
+        static const size_t align = 64;
+        
+        // main thread, while inactive
+        void reserve(size_t bytes)
+        {
+            storage.assign(bytes, 0);
+            used = 0;
+        }
+
+        // returns null (and asserts) if the reservation is exceeded
+        template <typename T>
+        T * alloc(size_t n)
+        {
+            size_t bytes = (n * sizeof(T) + align - 1) & ~(align - 1);
+            if(used + bytes > storage.size()) { assert(false); return 0; }
+
+            T * p = (T*) (storage.data() + used);
+            used += bytes;
+            return p;
+        }
+
+        size_t mark() const { return used; }
+        void release(size_t m) { used = m; }
+        void reset() { used = 0; }
+
+    private:
+        std::vector<uint8_t, ClapAlignedAllocator<uint8_t>> storage;
+        size_t  used = 0;
+    };
+
+    // Top-level editor panel, dispatches DSP -> GUI parameter changes
+    // once per GUI update (see ClapBase::update_gui_params).
+    struct ClapEditorPanel : Panel
+    {
+        Notify  onUpdate = doNothing;
+        
+        void ev_update() { onUpdate(); }
+    };
+
+    // Some basic stuff ...
+    //
+    // Eventually this should probably implement some basic parameter handling?
+    //
+    struct ClapBase : WindowDelegate
+    {
+        // Extension interfaces that we currently make use of..
+        struct {
+            const clap_host         *host;
+            const clap_host_params  *host_params;
+            const clap_host_gui     *host_gui;
+            const clap_host_thread_pool *host_thread_pool;
+            const clap_host_log     *host_log;
+            const clap_host_latency *host_latency;
+        } clap = {};
+
+        struct {
+            // Names of ports - first one is always main
+            // FIXME: might want to specify more stuff (eg. nChannels?)
+            std::vector<const char*>    audioIn;
+            std::vector<const char*>    audioOut;
+
+            // Names of note input ports, see also maxVoices
+            std::vector<const char*>    noteIn;
+
+            // smallest sub-block process_events() will split blocks into
+            uint32_t    minSubBlock = 16;
+
+            // max simultaneous note_ids with per-voice modulation
+            uint32_t    maxModVoices = 64;
+
+            // size of the voice pool, zero if voices are not used
+            uint32_t    maxVoices = 0;
+
+            // threads for parallel_exec() when the host thread-pool can't
+            // be used; with zero such tasks run serially on the audio thread
+            uint32_t    workerThreads = 0;
+
+            // advertise 64-bit ports, see process_audio()
+            bool        supports64 = false;
+
+            // length of the tail after the inputs go silent,
+            // infinite by default (see process_audio)
+            uint32_t    tailFrames = ~0u;
+
+            // let process_audio() put us to sleep after the tail, only set
+            // this if the output is silent whenever the inputs are and there
+            // are no events or voices (see keep_awake() otherwise)
+            bool        sleepWhenSilent = false;
+
+            // declare input and output ports with the same index as
+            // in-place pairs, see process_inplace()
+            bool        inPlacePairs = false;
+
+            // saved with the state, see ClapStateReader::version
+            uint32_t    stateVersion = 0;
+
+            // worst case scratch() use per block, as a number of buffers
+            // of max_frames samples (double if supports64) per channel
+            uint32_t    scratchBuffers = 0;
+            uint32_t    scratchChannels = 2;
+
+            // initial oversampling as log2 of the factor (0 to 4), can be
+            // changed later with set_oversampling(), see process_oversampled()
+            uint32_t    oversampling = 0;
+
+            // block size for process_fixed(), set before activation,
+            // can't be combined with oversampling
+            uint32_t    fixedBlockSize = 0;
+        } properties;
+
+        ClapEditorPanel plug_editor;    // Top level plug_editor Panel; use as a parent.
+        ClapEventQueue  gui_to_dsp;     // GUI to DSP event queue
+        ClapVoiceManager    voices;     // sized by properties.maxVoices
+
+#ifdef DUST_CLAP_PROFILE
+        // filled and logged by ClapWrapper, see ClapProfile::interval
+        ClapProfile     clap_profile;
+#endif
+
+        // short-hand for requesting flush
+        void flush_events()
+        {
+            if(clap.host_params) clap.host_params->request_flush(clap.host);
+        }
+
+        // see ClapSharedStateBase, main thread before activation
+        void register_shared_state(ClapSharedStateBase & state)
+        {
+            sharedStates.push_back(&state);
+        }
+
+        void register_param(AudioParam & param)
+        {
+            auto * p = &param;
+
+            p->id = paramStore.add(p->value_default);
+            p->store = &paramStore;
+            plug_params.push_back(p);
+            
+            textCache.emplace_back(p->cacheText ? new ClapTextCache : 0);
+            gui_to_dsp.setParamCount(plug_params.size());
+
+            // grow the dirty-set if necessary, everything starts dirty
+            unsigned nWords = (plug_params.size() + 63) / 64;
+            if(nWords > dirtyParams.size())
+                dirtyParams = std::vector<std::atomic<uint64_t>>(nWords);
+            for(auto * q : plug_params)
+                dirtyParams[q->id / 64] |= uint64_t(1) << (q->id % 64);
+
+            // keep the state keys sorted for plug_state_load
+            StateKey key = { p->stateKey, p->id };
+            if(!key.key)
+            {
+                key.key = *p->module ? clap_hash(p->name,
+                    clap_hash("/", clap_hash(p->module))) : clap_hash(p->name);
+            }
+            
+            auto at = std::lower_bound(stateKeys.begin(), stateKeys.end(), key);
+            if(at == stateKeys.end() || at->key != key.key) stateKeys.insert(at, key);
+            else if(p->stateKey || plug_params[at->id]->stateKey)
+            {
+                assert(false); stateKeyConflict = true;     // duplicate
+            }
+            else ++stateNameConflicts;  // same name, only the first is saved
+
+            p->setEdit = [this, p] (bool b)
+            { gui_to_dsp.setParamEditState(*p, b); flush_events(); };
+
+            p->setValue = [this, p] (float v)
+            { gui_to_dsp.setParamValue(*p, v); flush_events(); };
+
+        }
+        
+        // Wake up GUI controls for parameters that changed on the DSP side
+        // since the last call. The plug_editor calls this on every update.
+        //
+        // Only the dirty-set is scanned (a word at a time), so the cost
+        // doesn't depend on the number of parameters that didn't change.
+        void update_gui_params()
+        {
+            for(unsigned w = 0; w < dirtyParams.size(); ++w)
+            {
+                // relaxed load first, so clean words don't need a RMW
+                if(!dirtyParams[w].load(std::memory_order_relaxed)) continue;
+                
+                uint64_t bits = dirtyParams[w].exchange(0, std::memory_order_acquire);
+                while(bits)
+                {
+                    unsigned id = w*64 + clap_bit_low(bits);
+                    bits &= bits - 1;
+
+                    ++plug_params[id]->guiSerial;
+                }
+            }
+        }
+        
+        void flush_gui_events(const clap_output_events *out)
+        {
+            apply_loaded_state(out);
+            swap_shared_states();
+            
+            auto parse = [this](const clap_event_header * header)
+            {
+                if(header->space_id != CLAP_CORE_EVENT_SPACE_ID) return;
+
+                if(header->type == CLAP_EVENT_PARAM_GESTURE_BEGIN)
+                {
+                    auto * ev = (clap_event_param_gesture*) header;
+                    paramStore.inGesture[ev->param_id] = true;
+                    return;
+                }
+                
+                if(header->type == CLAP_EVENT_PARAM_GESTURE_END)
+                {
+                    auto * ev = (clap_event_param_gesture*) header;
+                    paramStore.inGesture[ev->param_id] = false;
+                    return;
+                }
+
+                if(header->type != CLAP_EVENT_PARAM_VALUE) return;
+
+                auto * ev = (clap_event_param_value*) header;
+
+                // we don't allow any of this for automation
+                if(ev->note_id != -1 || ev->port_index != -1
+                || ev->channel != -1 || ev->key != -1) return;
+
+                set_param_value(ev->param_id, ev->value);
+            };
+
+            // parse value events, then send everything to host?
+            gui_to_dsp.recv([&](const clap_event_header * ev)
+            { parse(ev); out->try_push(out, ev); });
+        }
+
+        ClapBase(const clap_host * _host)
+        {
+            clap.host = _host;
+            plug_editor.style.rule = LayoutStyle::FILL;
+            plug_editor.onUpdate = [this]() { update_gui_params(); };
+            voices.onEnd = [this](int32_t note_id) { release_voice_mod(note_id); };
+        }
+
+        bool plug_init()
+        {
+            clap.host_params = (const clap_host_params*)
+                clap.host->get_extension(clap.host, CLAP_EXT_PARAMS);
+                
+            clap.host_gui = (const clap_host_gui*)
+                clap.host->get_extension(clap.host, CLAP_EXT_GUI);
+
+            clap.host_thread_pool = (const clap_host_thread_pool*)
+                clap.host->get_extension(clap.host, CLAP_EXT_THREAD_POOL);
+
+            clap.host_log = (const clap_host_log*)
+                clap.host->get_extension(clap.host, CLAP_EXT_LOG);
+
+            clap.host_latency = (const clap_host_latency*)
+                clap.host->get_extension(clap.host, CLAP_EXT_LATENCY);
+
+            osLog2 = osPending = properties.oversampling;
+
+            // states would load into the wrong parameters
+            if(stateKeyConflict)
+            {
+                if(clap.host_log) clap.host_log->log(clap.host,
+                    CLAP_LOG_ERROR, "duplicate AudioParam::stateKey");
+                return false;
+            }
+            if(stateNameConflicts && clap.host_log)
+            {
+                char txt[96];
+                snprintf(txt, sizeof(txt), "%u parameter(s) not saved: same"
+                    " name as another and no AudioParam::stateKey",
+                    stateNameConflicts);
+                clap.host_log->log(clap.host, CLAP_LOG_WARNING, txt);
+            }
+                
+            return true;
+        }
+        // called by the glue before plug_activate(), so always runs
+        bool plug_activate_begin(double sampleRate, uint32_t, uint32_t maxFrames)
+        {
+            // process_fixed() and process_oversampled() don't combine
+            if(properties.fixedBlockSize && osPending)
+            {
+                if(clap.host_log) clap.host_log->log(clap.host, CLAP_LOG_ERROR,
+                    "fixedBlockSize can't be combined with oversampling");
+                return false;
+            }
+            
+            smoother.activate(paramStore, plug_params, sampleRate, maxFrames);
+            std::fill(paramStore.modOffset.begin(), paramStore.modOffset.end(), 0.f);
+            voiceMod.activate(plug_params, properties.maxModVoices);
+            voices.activate(properties.maxVoices);
+            workers.start(properties.workerThreads);
+            silentFrames = 0;
+
+            // apply block size and oversampling changes from while we
+            // were active, the host must be told if the latency changes
+            uint32_t latency = plug_latency_get();
+            fixedSize = properties.fixedBlockSize;
+            osLog2 = osPending;
+            oversampler.setup(properties.audioIn.size() * 2,
+                properties.audioOut.size() * 2, maxFrames, osLog2);
+            if(latency != plug_latency_get() && clap.host_latency)
+                clap.host_latency->changed(clap.host);
+
+            // room for input and output FIFOs of every channel and for
+            // events of a whole fixed block plus the largest host block
+            fixedFill = 0;
+            fixedStream = 0;
+            fixedFifo.assign(fixedSize * 2 * (properties.audioIn.size()
+                + properties.audioOut.size()), 0.);
+            fixedEvents.clear();
+            fixedEventBytes = fixedSize ? std::max<size_t>(32768,
+                size_t(fixedSize + maxFrames) * fixedEventsPerFrame) : 0;
+            fixedEvents.reserve(fixedEventBytes);
+
+            size_t sampleSize = properties.supports64 ? 8 : 4;
+            size_t bufferSize = ((std::max(maxFrames, fixedSize) << osLog2) * sampleSize
+                + ClapScratchArena::align - 1) & ~(ClapScratchArena::align - 1);
+            scratchArena.reserve(bufferSize
+                * properties.scratchBuffers * properties.scratchChannels);
+
+            // the DSP isn't running, so take anything published already
+            swap_shared_states();
+            for(auto * s : sharedStates) s->reclaim();
+            
+            isActive = true;
+            return true;
+        }
+
+        bool plug_activate(double, uint32_t, uint32_t) { return true; }
+        void plug_deactivate() {}
+
+        // called by the glue after plug_deactivate()
+        void plug_deactivate_end() { workers.stop(); isActive = false; }
+
+        // called by the glue before plug_reset(), modulation starts over
+        void plug_reset_begin()
+        {
+            std::fill(paramStore.modOffset.begin(), paramStore.modOffset.end(), 0.f);
+            voiceMod.clear();
+        }
+        bool plug_start_processing() { return true; }
+        bool plug_stop_processing() { return true; }
+
+        // called by the glue before every plug_process()
+        void plug_process_begin(const clap_process *) { scratchArena.reset(); }
+
+        // plugins implementing plug_on_main_thread() should call this too
+        void plug_on_main_thread()
+        {
+            for(auto * s : sharedStates) s->reclaim();
+            if(uint32_t n = fixedDropped.exchange(0))
+            {
+                char txt[64];
+                snprintf(txt, sizeof(txt), "process_fixed: %u events dropped", n);
+                if(clap.host_log) clap.host_log->log(
+                    clap.host, CLAP_LOG_PLUGIN_MISBEHAVING, txt);
+            }
+        }
+
+        // parameter support
+        uint32_t plug_params_count() { return plug_params.size(); }
+
+        bool plug_params_get_info(uint32_t index, clap_param_info *info)
+        {
+            if(index >= plug_params.size()) return false;
+
+            auto * p = plug_params[index];
+            
+            info->id = p->id;
+            info->flags = p->clap_flags;
+            if(p->modulatable) info->flags |= CLAP_PARAM_IS_MODULATABLE
+                | CLAP_PARAM_IS_MODULATABLE_PER_NOTE_ID;
+            info->cookie = (void*) p;
+            
+            strncpy(info->name, p->name, CLAP_NAME_SIZE);
+            info->name[CLAP_NAME_SIZE-1] = 0;
+
+            strncpy(info->module, p->module, CLAP_PATH_SIZE);
+            info->module[CLAP_PATH_SIZE-1] = 0;
+
+            info->min_value = 0;
+            info->max_value = 1;
+            info->default_value = paramStore.value_default[index];
+
+            return true;
+        }
+
+        bool plug_params_get_value(clap_id id, double *value)
+        {
+            if(id >= plug_params.size()) return false;
+            memfence();
+            *value = paramStore.value[id];
+            memfence();
+            return true;
+        }
+
+        bool plug_params_value_to_text(clap_id id, double v, char *txt, uint32_t size)
+        {
+            if(id >= plug_params.size() || !size) return false;
+
+            auto * p = plug_params[id];
+            auto * cache = textCache[id].get();
+            
+            if(cache && cache->getText(v, txt, size)) return true;
+
+            if(p->value_to_text)
+            {
+                auto s = p->value_to_text(v);
+                ClapTextCache::copyText(txt, s.c_str(), size);
+            }
+            else p->format(v, txt, size);
+
+            // don't cache text that might have been truncated
+            if(cache && strlen(txt) + 1 < size) cache->putText(v, txt);
+
+            return true;
+        }
+
+        bool plug_params_text_to_value(clap_id id, const char * txt, double *value)
+        {
+            if(id >= plug_params.size()) return false;
+
+            auto * cache = textCache[id].get();
+            
+            float v;
+            if(!cache || !cache->getValue(txt, v))
+            {
+                v = plug_params[id]->text_to_value(txt);
+                if(cache) cache->putValue(txt, v);
+            }
+            
+            *value = v;
+            return true;
+        }
+
+        void plug_params_flush(
+            const clap_input_events *in, const clap_output_events *out)
+        {
+            flush_gui_events(out);
+            
+            if(in)
+            {
+                auto inputSize = in->size(in);
+                for(uint32_t i = 0; i < inputSize; ++i)
+                {
+                    parse_host_event(in->get(in, i));
+                }
+            }
+        }
+
+        // Plugin defined state beyond parameter values (eg. sample paths or
+        // a custom wavetable), saved as its own section with the given tag
+        // (anything but zero and 'PRMS'). The loader is only called if the
+        // section was found in the state, and can read up to remaining()
+        // bytes from it. Register on the main thread, before activation.
+        void register_state_chunk(uint32_t tag,
+            std::function<bool(ClapStateWriter &)> save,
+            std::function<bool(ClapStateReader &)> load)
+        {
+            assert(tag && tag != stateParamTag);
+            stateChunks.push_back({ tag, save, load });
+        }
+
+        // State format (version 1), all little-endian:
+        //
+        //   u32 magic 'DCST', u32 format version, u32 properties.stateVersion
+        //   sections: u32 tag, u32 size, then size bytes of data
+        //   u32 zero tag to end
+        //
+        // Parameters go into the 'PRMS' section as a u32 count followed by
+        // (u32 key, f32 value) pairs, keyed by AudioParam::stateKey (or
+        // the name) so that adding or reordering parameters doesn't break
+        // old states. Unknown sections and keys are skipped and missing
+        // parameters get defaults.
+        bool plug_state_save(const clap_ostream * stream)
+        {
+            ClapStateWriter w;
+            w.data.reserve(64 + 8 * plug_params.size());
+            
+            w.putU32(stateMagic);
+            w.putU32(stateFormat);
+            w.putU32(properties.stateVersion);
+
+            size_t at = w.beginSection(stateParamTag);
+            w.putU32(stateKeys.size());
+            for(auto & k : stateKeys)
+            {
+                w.putU32(k.key);
+                w.putF32(paramStore.value[k.id]);
+            }
+            w.endSection(at);
+
+            for(auto & c : stateChunks)
+            {
+                at = w.beginSection(c.tag);
+                if(!c.save(w)) return false;
+                w.endSection(at);
+            }
+            
+            w.putU32(0);
+            return w.write(stream);
+        }
+
+        // Parameters are applied directly while inactive, otherwise the DSP
+        // picks them up at the next process() or flush (and tells the host).
+        bool plug_state_load(const clap_istream * stream)
+        {
+            ClapStateReader r(stream);
+
+            uint32_t magic, format;
+            if(!r.getU32(magic) || magic != stateMagic) return false;
+            if(!r.getU32(format) || format > stateFormat) return false;
+            if(!r.getU32(r.version)) return false;
+
+            // make sure the DSP isn't reading the previous load
+            for(;;)
+            {
+                int s = statePending;
+                if(stateLoad.compare_exchange_weak(s, stateIdle)) break;
+                if(s == stateIdle) break;
+                std::this_thread::yield();
+            }
+
+            loadedValues.assign(
+                paramStore.value_default.begin(), paramStore.value_default.end());
+
+            for(;;)
+            {
+                uint32_t tag, size;
+                if(!r.getU32(tag)) return false;
+                if(!tag) break;
+                if(!r.getU32(size)) return false;
+
+                r.beginSection(size);
+                if(tag == stateParamTag)
+                {
+                    if(!load_state_params(r)) return false;
+                }
+                else for(auto & c : stateChunks)
+                {
+                    if(c.tag == tag && !c.load(r)) return false;
+                }
+                if(!r.endSection()) return false;
+            }
+
+            if(isActive)
+            {
+                stateLoad.store(statePending, std::memory_order_release);
+                flush_events();
+                return true;
+            }
+
+            for(auto & k : stateKeys) set_param_value(k.id, loadedValues[k.id]);
+            if(clap.host_params)
+                clap.host_params->rescan(clap.host, CLAP_PARAM_RESCAN_VALUES);
+            return true;
+        }
+
+        // Sample-accurate process driver, call from plug_process().
+        //
+        // Walks the (time-sorted) input events, applies parameter values at
+        // their exact time and calls render(offset, frames) for every
+        // sub-block in between. All other events (notes, gestures, etc) are
+        // passed to event(header) at their time, before rendering continues.
+        //
+        // Events less than properties.minSubBlock frames from the start of
+        // the current sub-block are applied early (at the start of the
+        // sub-block) so that dense automation doesn't split processing into
+        // tiny pieces. Set minSubBlock to 1 for fully sample-accurate timing.
+        template <typename Render, typename Event>
+        clap_process_status process_events(
+            const clap_process * proc, Render && render, Event && event)
+        {
+            flush_gui_events(proc->out_events);
+
+            // scratch() from inside render() is released after each call
+            auto renderScratch = [&](uint32_t offset, uint32_t frames)
+            {
+                size_t mark = scratchArena.mark();
+                render(offset, frames);
+                scratchArena.release(mark);
+            };
+
+            uint32_t frames = proc->frames_count;
+            uint32_t offset = 0;
+            uint32_t nSubBlocks = 0;
+
+            auto * in = proc->in_events;
+            uint32_t nEvents = in ? in->size(in) : 0;
+            
+            for(uint32_t i = 0; i < nEvents; ++i)
+            {
+                auto * header = in->get(in, i);
+
+                // clip bogus time-stamps to the end of the block
+                uint32_t time = header->time < frames ? header->time : frames;
+                if(time >= offset + properties.minSubBlock)
+                {
+                    smoother.run(time - offset);
+                    renderScratch(offset, time - offset);
+                    offset = time;
+                    ++nSubBlocks;
+                }
+                
+                if(!parse_host_event(header)) event(header);
+            }
+
+            if(offset < frames)
+            {
+                smoother.run(frames - offset);
+                renderScratch(offset, frames - offset);
+                ++nSubBlocks;
+            }
+
+#ifdef DUST_CLAP_PROFILE
+            clap_profile.addSubBlocks(nSubBlocks);
+#endif
 
-            p->setValue = [this, p] (float v)
-            { gui_to_dsp.setParamValue(*p, v); flush_events(); };
+            return CLAP_PROCESS_CONTINUE;
+        }
 
+        // same as above, but ignore everything but parameter values
+        template <typename Render>
+        clap_process_status process_events(
+            const clap_process * proc, Render && render)
+        {
+            return process_events(proc, render, [](const clap_event_header*){});
         }
-        
-        void flush_gui_events(const clap_output_events *out)
+
+        // Same as process_events(), but render(block) gets a ClapAudioBlock
+        // of either float or double depending on the host buffers, so the
+        // plugin can write a single templated render and pass it as:
+        //
+        //   return process_audio(proc, [&](auto & block) { render(block); });
+        //
+        // Double buffers are only used if properties.supports64 is set.
+        //
+        // With properties.sleepWhenSilent (and a finite tailFrames) this
+        // also tracks silence: once all inputs have been silent (by
+        // constant_mask or by scanning) for longer than properties.tailFrames
+        // with no events and no active voices, render is skipped entirely,
+        // outputs are cleared (and marked constant) and we ask the host to
+        // put us to sleep. While the tail is still ringing we return
+        // CLAP_PROCESS_TAIL, so the host can rely on the tail extension.
+        // Plugins without inputs are always "silent", so those (and any
+        // plugin with activity other than voices) should call keep_awake()
+        // from render whenever they are still making sound.
+        template <typename Render, typename Event>
+        clap_process_status process_audio(
+            const clap_process * proc, Render && render, Event && event)
         {
-            auto parse = [this](const clap_event_header * header)
+            bool is64 = uses64(proc);
+            
+            bool silentIn = properties.sleepWhenSilent
+                && properties.tailFrames != ~0u && (is64
+                ? inputs_silent<double>(proc) : inputs_silent<float>(proc));
+            
+            if(!silentIn) silentFrames = 0;
+            else if(silentFrames < properties.tailFrames)
             {
-                if(header->space_id != CLAP_CORE_EVENT_SPACE_ID) return;
+                silentFrames = std::min<uint64_t>(
+                    uint64_t(silentFrames) + proc->frames_count, properties.tailFrames);
+            }
+            else if(!voices.count() && !(proc->in_events
+                && proc->in_events->size(proc->in_events)))
+            {
+                flush_gui_events(proc->out_events);
+                if(is64) clear_outputs<double>(proc);
+                else clear_outputs<float>(proc);
+                return CLAP_PROCESS_SLEEP;
+            }
 
-                if(header->type == CLAP_EVENT_PARAM_GESTURE_BEGIN)
+            for(uint32_t i = 0; i < proc->audio_outputs_count; ++i)
+                proc->audio_outputs[i].constant_mask = 0;
+
+            clap_process_status status;
+            if(is64) status = process_events(proc,
+                [&](uint32_t offset, uint32_t frames)
                 {
-                    auto * ev = (clap_event_param_gesture*) header;
-                    plug_params[ev->param_id]->inGesture = true;
-                    return;
-                }
-                
-                if(header->type == CLAP_EVENT_PARAM_GESTURE_END)
+                    ClapAudioBlock<double> block = { proc, offset, frames };
+                    render(block);
+                }, event);
+            else status = process_events(proc,
+                [&](uint32_t offset, uint32_t frames)
                 {
-                    auto * ev = (clap_event_param_gesture*) header;
-                    plug_params[ev->param_id]->inGesture = false;
-                    return;
-                }
-
-                if(header->type != CLAP_EVENT_PARAM_VALUE) return;
+                    ClapAudioBlock<float> block = { proc, offset, frames };
+                    render(block);
+                }, event);
 
-                auto * ev = (clap_event_param_value*) header;
+            if(silentIn && status == CLAP_PROCESS_CONTINUE)
+                return CLAP_PROCESS_TAIL;
+            
+            return status;
+        }
 
-                // we don't allow any of this for automation
-                if(ev->note_id != -1 || ev->port_index != -1
-                || ev->channel != -1 || ev->key != -1) return;
+        template <typename Render>
+        clap_process_status process_audio(
+            const clap_process * proc, Render && render)
+        {
+            return process_audio(proc, render, [](const clap_event_header*){});
+        }
 
-                auto * p = plug_params[ev->param_id];
-                p->value = ev->value;
-            };
+        // restart the tail, for sound that process_audio() can't see
+        void keep_awake() { silentFrames = 0; }
+
+        // Same as process_audio(), but for an in-place kernel that only
+        // processes block.out() of ports paired by properties.inPlacePairs.
+        //
+        // When the host gives us aliased buffers the kernel runs on them
+        // directly, otherwise the inputs of each sub-block are first copied
+        // to the outputs. Output channels without a matching input channel
+        // are left for the kernel to fill.
+        template <typename Kernel, typename Event>
+        clap_process_status process_inplace(
+            const clap_process * proc, Kernel && kernel, Event && event)
+        {
+            if(is_inplace(proc)) return process_audio(proc, kernel, event);
 
-            // parse value events, then send everything to host?
-            gui_to_dsp.recv([&](const clap_event_header * ev)
-            { parse(ev); out->try_push(out, ev); });
+            return process_audio(proc, [&](auto & block)
+            {
+                uint32_t nPorts = std::min(block.nInputs(), block.nOutputs());
+                for(uint32_t port = 0; port < nPorts; ++port)
+                {
+                    // hosts may leave buffers of either side null
+                    auto ** inData = block.data(proc->audio_inputs[port]);
+                    auto ** outData = block.data(proc->audio_outputs[port]);
+                    if(!inData || !outData) continue;
+                    
+                    uint32_t nCh = std::min(
+                        block.nInChannels(port), block.nOutChannels(port));
+                    for(uint32_t ch = 0; ch < nCh; ++ch)
+                    {
+                        if(!inData[ch] || !outData[ch]) continue;
+                        
+                        auto * in = block.in(port, ch);
+                        auto * out = block.out(port, ch);
+                        if(in != out) memcpy(out, in, block.frames * sizeof(*in));
+                    }
+                }
+                kernel(block);
+            }, event);
         }
 
-        ClapBase(const clap_host * _host)
+        template <typename Kernel>
+        clap_process_status process_inplace(
+            const clap_process * proc, Kernel && kernel)
         {
-            clap.host = _host;
-            plug_editor.style.rule = LayoutStyle::FILL;
+            return process_inplace(proc, kernel, [](const clap_event_header*){});
         }
 
-        bool plug_init()
+        // Same as process_audio(), but render(block) runs at the rate set
+        // by set_oversampling() and gets a ClapOversampledBlock (or just a
+        // ClapAudioBlock without oversampling), so it should be generic:
+        //
+        //   return process_oversampled(proc, [&](auto & block) { ... });
+        //
+        // The latency of the filters is reported automatically, but it
+        // should be included in properties.tailFrames. Parameter values
+        // and smoothed() buffers remain at the base rate.
+        template <typename Render, typename Event>
+        clap_process_status process_oversampled(
+            const clap_process * proc, Render && render, Event && event)
         {
-            clap.host_params = (const clap_host_params*)
-                clap.host->get_extension(clap.host, CLAP_EXT_PARAMS);
-                
-            clap.host_gui = (const clap_host_gui*)
-                clap.host->get_extension(clap.host, CLAP_EXT_GUI);
+            if(!osLog2) return process_audio(proc, render, event);
+            
+            return process_audio(proc, [&](auto & block)
+            {
+                uint32_t nIn = std::min<uint32_t>(
+                    block.nInputs(), properties.audioIn.size());
+                uint32_t nOut = std::min<uint32_t>(
+                    block.nOutputs(), properties.audioOut.size());
                 
-            return true;
+                for(uint32_t port = 0; port < nIn; ++port)
+                {
+                    uint32_t nCh = std::min(block.nInChannels(port), 2u);
+                    for(uint32_t ch = 0; ch < nCh; ++ch)
+                        oversampler.up(port*2 + ch, block.in(port, ch), block.frames);
+                }
+
+                ClapOversampledBlock osBlock = { &oversampler, proc,
+                    block.offset << osLog2, block.frames << osLog2, nIn, nOut };
+                render(osBlock);
+
+                for(uint32_t port = 0; port < nOut; ++port)
+                {
+                    uint32_t nCh = std::min(block.nOutChannels(port), 2u);
+                    for(uint32_t ch = 0; ch < nCh; ++ch)
+                        oversampler.down(port*2 + ch, block.out(port, ch), block.frames);
+                }
+            }, event);
         }
-        void plug_deactivate() {}
-        bool plug_start_processing() { return true; }
-        bool plug_stop_processing() { return true; }
-        void plug_on_main_thread() {}
 
-        // parameter support
-        uint32_t plug_params_count() { return plug_params.size(); }
+        template <typename Render>
+        clap_process_status process_oversampled(
+            const clap_process * proc, Render && render)
+        {
+            return process_oversampled(proc, render, [](const clap_event_header*){});
+        }
 
-        bool plug_params_get_info(uint32_t index, clap_param_info *info)
+        // Same as process_audio(), but render(block) always gets a
+        // ClapFixedBlock of properties.fixedBlockSize frames (eg. for FFT
+        // processing), at the cost of that much latency, which is reported
+        // automatically (but should also be included in tailFrames).
+        //
+        // Input is collected into a FIFO, each full block is rendered and
+        // then played back while the next one is collected. Events are
+        // passed to event(header) just before the block that contains
+        // them, with time relative to the start of that block. Parameter
+        // values are applied when received, so a block sees the values at
+        // the end of its input (smoothed() isn't useful here).
+        template <typename Render, typename Event>
+        clap_process_status process_fixed(
+            const clap_process * proc, Render && render, Event && event)
         {
-            if(index >= plug_params.size()) return false;
+            if(!fixedSize) return process_audio(proc, render, event);
 
-            auto * p = plug_params[index];
-            
-            info->id = p->id;
-            info->flags = p->clap_flags;
-            info->cookie = (void*) p;
+            uint64_t blockStart = fixedStream;
             
-            strncpy(info->name, p->name, CLAP_NAME_SIZE);
-            info->name[CLAP_NAME_SIZE-1] = 0;
-
-            strncpy(info->module, p->module, CLAP_PATH_SIZE);
-            info->module[CLAP_PATH_SIZE-1] = 0;
-
-            info->min_value = 0;
-            info->max_value = 1;
-            info->default_value = p->value_default;
+            return process_audio(proc, [&](auto & block)
+            {
+                typedef std::remove_const_t<
+                    std::remove_pointer_t<decltype(block.in(0,0))>> T;
+                
+                uint32_t nIn = std::min<uint32_t>(
+                    block.nInputs(), properties.audioIn.size());
+                uint32_t nOut = std::min<uint32_t>(
+                    block.nOutputs(), properties.audioOut.size());
+                
+                ClapFixedBlock<T> fixed = { (T*) fixedFifo.data(), proc, 0,
+                    fixedSize, nIn, nOut, (uint32_t) properties.audioIn.size() };
 
-            return true;
+                for(uint32_t done = 0; done < block.frames;)
+                {
+                    uint32_t n = std::min(block.frames - done, fixedSize - fixedFill);
+
+                    // swap input into the FIFO, output out of it
+                    for(uint32_t port = 0; port < nIn; ++port)
+                    {
+                        uint32_t nCh = std::min(block.nInChannels(port), 2u);
+                        for(uint32_t ch = 0; ch < nCh; ++ch)
+                            memcpy((T*) fixed.in(port, ch) + fixedFill,
+                                block.in(port, ch) + done, n * sizeof(T));
+                    }
+                    for(uint32_t port = 0; port < nOut; ++port)
+                    {
+                        uint32_t nCh = std::min(block.nOutChannels(port), 2u);
+                        for(uint32_t ch = 0; ch < nCh; ++ch)
+                            memcpy(block.out(port, ch) + done,
+                                fixed.out(port, ch) + fixedFill, n * sizeof(T));
+                    }
+                    
+                    done += n;
+                    fixedFill += n;
+                    fixedStream += n;
+                    if(fixedFill < fixedSize) continue;
+
+                    fixedFill = 0;
+                    dispatch_fixed_events(fixedStream - fixedSize, fixedStream, event);
+                    render(fixed);
+                }
+            }, [&](const clap_event_header * header)
+            {
+                // position in the stream, process_events() clips the time
+                uint32_t time = std::min(header->time, proc->frames_count);
+                queue_fixed_event(header, blockStart + time);
+            });
         }
 
-        bool plug_params_get_value(clap_id id, double *value)
+        template <typename Render>
+        clap_process_status process_fixed(
+            const clap_process * proc, Render && render)
         {
-            if(id >= plug_params.size()) return false;
-            auto * p = plug_params[id];
-            memfence();
-            *value = p->value;
-            memfence();
-            return true;
+            return process_fixed(proc, render, [](const clap_event_header*){});
         }
 
-        bool plug_params_value_to_text(clap_id id, double v, char *txt, uint32_t size)
+        // Change the oversampling factor (as log2, 0 to 4) from the main
+        // thread. The new factor (and latency) takes effect on the next
+        // activation, which the host is asked for if we're active.
+        void set_oversampling(uint32_t log2)
         {
-            if(id >= plug_params.size()) return false;
-
-            auto s = plug_params[id]->value_to_text(v);
-            
-            strncpy(txt, s.c_str(), size);
-            txt[size-1] = 0;
-
-            return true;
+            osPending = std::min(log2, ClapOversampler::maxLog2);
+            if(osPending != osLog2 && isActive) clap.host->request_restart(clap.host);
         }
 
-        bool plug_params_text_to_value(clap_id id, const char * txt, double *value)
+        // oversampling factor in use (since the last activation)
+        uint32_t oversampling() const { return 1 << osLog2; }
+
+        // only one of these is ever non-zero, see plug_activate_begin()
+        uint32_t plug_latency_get()
         {
-            if(id >= plug_params.size()) return false;
-            *value = plug_params[id]->text_to_value(txt);
-            return true;
+            return ClapOversampler::latency(osLog2) + fixedSize;
         }
 
-        void plug_params_flush(
-            const clap_input_events *in, const clap_output_events *out)
+        // Temporary buffer of n samples (64-byte aligned) from the scratch
+        // arena, see properties.scratchBuffers. Never allocates. Buffers
+        // taken in plug_process() outside render() last until the end of
+        // the block (the arena is reset by plug_process_begin() whatever
+        // path plug_process() takes) and those taken in render() only until
+        // it returns (so each sub-block starts over with the same space).
+        template <typename T>
+        T * scratch(uint32_t n) { return scratchArena.alloc<T>(n); }
+
+        // per-sample values for the current sub-block of process_events()
+        // for a parameter with smoothing enabled, valid during render()
+        const float * smoothed(const AudioParam & p) const
+        { return smoother.get(p.id); }
+
+        // value plus global modulation
+        float modulated(const AudioParam & p) const
+        { return paramStore.value[p.id] + paramStore.modOffset[p.id]; }
+
+        // value plus global and per-voice modulation, where the slot
+        // is from voice_mod_slot() which only needs to be called once
+        // per voice per block (or sub-block)
+        float modulated(const AudioParam & p, int slot) const
+        { return modulated(p) + voiceMod.get(slot, p.id); }
+
+        int voice_mod_slot(int32_t note_id) const
+        { return voiceMod.find(note_id); }
+
+        // call when a voice ends, so the slot can be reused
+        void release_voice_mod(int32_t note_id) { voiceMod.release(note_id); }
+        
+        // tail length, see process_audio()
+        uint32_t plug_tail_get() { return properties.tailFrames; }
+
+        // Run fn(task_index) for every task_index < nTasks in parallel and
+        // wait for all of them, call from plug_process() only. Plugins must
+        // also expose ClapExt_thread_pool for the host to run the tasks.
+        //
+        // The host thread-pool is used when available, otherwise tasks go
+        // to the fallback workers (see properties.workerThreads). Tasks are
+        // the same either way, so as long as each writes only its own
+        // outputs (eg. one voice group or one bus each) and the plugin
+        // combines them in task order, the results are deterministic.
+        template <typename Fn>
+        void parallel_exec(uint32_t nTasks, Fn && fn)
         {
-            flush_gui_events(out);
+            typedef std::remove_reference_t<Fn> FnType;
             
-            auto parse = [this](const clap_event_header * header)
-            {
-                // supposedly we only care about parameters here
-                if(header->space_id != CLAP_CORE_EVENT_SPACE_ID
-                || header->type != CLAP_EVENT_PARAM_VALUE) return;
-
-                auto * ev = (clap_event_param_value*) header;
+            taskCtx = (void*) &fn;
+            taskFn = [](void * ctx, uint32_t i) { (*(FnType*)ctx)(i); };
 
-                // we don't allow any of this for automation
-                if(ev->note_id != -1 || ev->port_index != -1
-                || ev->channel != -1 || ev->key != -1) return;
+            if(clap.host_thread_pool
+            && clap.host_thread_pool->request_exec(clap.host, nTasks)) return;
 
-                auto * p = plug_params[ev->param_id];
-                if(!p->inGesture) p->value = ev->value;
-            };
+            workers.run(nTasks, taskFn, taskCtx);
+        }
 
-            if(in)
-            {
-                auto inputSize = in->size(in);
-                for(int i = 0; i < inputSize; ++i)
-                {
-                    parse(in->get(in, i));
-                }
-            }
+        // host thread-pool entry point, see parallel_exec()
+        void plug_thread_pool_exec(uint32_t task_index)
+        {
+            taskFn(taskCtx, task_index);
         }
         
-        
         // FIXME: make this support any number of ports
         uint32_t plug_audio_ports_count(bool input)
         {
@@ -342,20 +2736,48 @@ namespace dust
             
             info->flags = CLAP_AUDIO_PORT_REQUIRES_COMMON_SAMPLE_SIZE;
             if(index == 0) info->flags |= CLAP_AUDIO_PORT_IS_MAIN;
+            if(properties.supports64) info->flags |= CLAP_AUDIO_PORT_SUPPORTS_64BITS;
         
             info->channel_count = 2;
             info->port_type = CLAP_PORT_STEREO;
             info->in_place_pair = CLAP_INVALID_ID;
+            if(properties.inPlacePairs && index < properties.audioIn.size()
+            && index < properties.audioOut.size())
+            {
+                // id of the port with same index in the other direction
+                info->in_place_pair = index | (input ? 0x10000 : 0);
+            }
     
             return true;
         }
 
-        // FIXME: ...
-        uint32_t plug_note_ports_count(bool input) { return 0; }
+        uint32_t plug_note_ports_count(bool input)
+        {
+            return input ? properties.noteIn.size() : 0;
+        }
+        
         bool plug_note_ports_get(
             uint32_t index, bool input, clap_note_port_info * info)
         {
-            return false;
+            if(!input || index >= properties.noteIn.size()) return false;
+
+            info->id = index;
+            info->supported_dialects = CLAP_NOTE_DIALECT_CLAP;
+            info->preferred_dialect = CLAP_NOTE_DIALECT_CLAP;
+            
+            strncpy(info->name, properties.noteIn[index], CLAP_NAME_SIZE);
+            info->name[CLAP_NAME_SIZE-1] = 0;
+            
+            return true;
+        }
+
+        // voice info, from the voice pool
+        bool plug_voice_info_get(clap_voice_info * info)
+        {
+            info->voice_count = voices.capacity();
+            info->voice_capacity = voices.capacity();
+            info->flags = CLAP_VOICE_INFO_SUPPORTS_OVERLAPPING_NOTES;
+            return true;
         }
 
         // GUI
@@ -448,6 +2870,257 @@ namespace dust
         }
 
     private:
+        // ports share a common sample size, so check the first one
+        bool uses64(const clap_process * proc)
+        {
+            if(!properties.supports64) return false;
+            
+            if(proc->audio_outputs_count) return proc->audio_outputs[0].data64;
+            if(proc->audio_inputs_count) return proc->audio_inputs[0].data64;
+            return false;
+        }
+        
+        // are all input channels zero?
+        template <typename T>
+        bool inputs_silent(const clap_process * proc)
+        {
+            // scan sample bits without the sign, this vectorizes
+            // without having to relax floating point semantics
+            typedef typename std::conditional<
+                sizeof(T) == 8, uint64_t, uint32_t>::type Bits;
+            const Bits absMask = ~Bits(0) >> 1;
+            
+            for(uint32_t port = 0; port < proc->audio_inputs_count; ++port)
+            {
+                auto & in = proc->audio_inputs[port];
+                T ** data = ClapAudioBlock<T>::data(in);
+                
+                for(uint32_t ch = 0; ch < in.channel_count; ++ch)
+                {
+                    uint32_t n = proc->frames_count;
+                    if(ch < 64 && (in.constant_mask & (uint64_t(1) << ch))) n = 1;
+                    if(!data || !data[ch]) continue;
+
+                    const Bits * x = (const Bits*) data[ch];
+                    Bits acc = 0;
+                    for(uint32_t i = 0; i < n; ++i) acc |= x[i] & absMask;
+                    if(acc) return false;
+                }
+            }
+            return true;
+        }
+
+        template <typename T>
+        void clear_outputs(const clap_process * proc)
+        {
+            for(uint32_t port = 0; port < proc->audio_outputs_count; ++port)
+            {
+                auto & out = proc->audio_outputs[port];
+                T ** data = ClapAudioBlock<T>::data(out);
+                if(!data) continue;
+
+                for(uint32_t ch = 0; ch < out.channel_count; ++ch)
+                    if(data[ch]) memset(data[ch], 0, proc->frames_count * sizeof(T));
+
+                out.constant_mask = ~uint64_t(0);
+            }
+        }
+        
+        // do all paired channels share buffers?
+        bool is_inplace(const clap_process * proc)
+        {
+            uint32_t nPorts = std::min(
+                proc->audio_inputs_count, proc->audio_outputs_count);
+            for(uint32_t port = 0; port < nPorts; ++port)
+            {
+                auto & in = proc->audio_inputs[port];
+                auto & out = proc->audio_outputs[port];
+                
+                uint32_t nCh = std::min(in.channel_count, out.channel_count);
+                if(!nCh) continue;
+
+                // either side without buffers (or mixed 32/64) is not in-place
+                if(!in.data32 != !out.data32) return false;
+                if(!in.data64 != !out.data64) return false;
+                if(!in.data32 && !in.data64) return false;
+                
+                for(uint32_t ch = 0; ch < nCh; ++ch)
+                {
+                    if(in.data32 && (!in.data32[ch]
+                        || in.data32[ch] != out.data32[ch])) return false;
+                    if(in.data64 && (!in.data64[ch]
+                        || in.data64[ch] != out.data64[ch])) return false;
+                }
+            }
+            return true;
+        }
+
+        // all parameter changes on the DSP side should go through here
+        void set_param_value(clap_id id, float v)
+        {
+            paramStore.value[id] = v;
+            if(isActive) smoother.retarget(id, v);
+            
+            dirtyParams[id / 64].fetch_or(
+                uint64_t(1) << (id % 64), std::memory_order_release);
+        }
+        
+        // apply parameter value events from the host, returns false
+        // for anything that should be passed on to the plugin instead
+        bool parse_host_event(const clap_event_header * header)
+        {
+            if(header->space_id != CLAP_CORE_EVENT_SPACE_ID) return false;
+
+            if(header->type == CLAP_EVENT_PARAM_MOD)
+            {
+                auto * ev = (clap_event_param_mod*) header;
+                if(ev->param_id >= paramStore.size()
+                || !plug_params[ev->param_id]->modulatable) return true;
+
+                // note_id identifies the voice, whatever else is set
+                if(ev->note_id != -1)
+                    voiceMod.set(ev->note_id, ev->param_id, ev->amount);
+                else if(ev->port_index == -1 && ev->channel == -1 && ev->key == -1)
+                    paramStore.modOffset[ev->param_id] = ev->amount;
+                else
+                {
+                    // per key: the matching voices (that have a note_id)
+                    voices.match(-1, ev->port_index, ev->channel, ev->key,
+                        [&](int v)
+                        {
+                            if(voices[v].note_id != -1)
+                                voiceMod.set(voices[v].note_id, ev->param_id, ev->amount);
+                        });
+                }
+                return true;
+            }
+
+            if(header->type != CLAP_EVENT_PARAM_VALUE) return false;
+
+            auto * ev = (clap_event_param_value*) header;
+
+            // we don't allow any of this for automation
+            if(ev->note_id != -1 || ev->port_index != -1
+            || ev->channel != -1 || ev->key != -1) return true;
+
+            if(ev->param_id >= paramStore.size()) return true;
+
+            if(!paramStore.inGesture[ev->param_id])
+                set_param_value(ev->param_id, ev->value);
+            return true;
+        }
+        
+        bool load_state_params(ClapStateReader & r)
+        {
+            uint32_t count;
+            if(!r.getU32(count) || count > r.remaining() / 8) return false;
+
+            for(uint32_t i = 0; i < count; ++i)
+            {
+                StateKey k = {};
+                float v;
+                if(!r.getU32(k.key) || !r.getF32(v)) return false;
+
+                auto at = std::lower_bound(stateKeys.begin(), stateKeys.end(), k);
+                if(at == stateKeys.end() || at->key != k.key) continue;
+                
+                // parameters are normalized, this also catches NaN
+                loadedValues[at->id] = (v >= 0.f) ? std::min(v, 1.f) : 0.f;
+            }
+            return true;
+        }
+
+        // events for process_fixed() are kept as records of stream position
+        // followed by a copy of the event, padded to 8 bytes
+        void queue_fixed_event(const clap_event_header * header, uint64_t pos)
+        {
+            size_t n = sizeof(uint64_t) + ((header->size + 7) & ~7u);
+            if(fixedEvents.size() + n > fixedEventBytes)
+            {
+                // full, drop (and report on the main thread)
+                assert(false);
+                if(!fixedDropped.fetch_add(1)) clap.host->request_callback(clap.host);
+                return;
+            }
+            
+            size_t at = fixedEvents.size();
+            fixedEvents.resize(at + n);
+            memcpy(fixedEvents.data() + at, &pos, sizeof(uint64_t));
+            memcpy(fixedEvents.data() + at + sizeof(uint64_t), header, header->size);
+        }
+
+        // pass events in [from, to) of the stream to event(), re-timed
+        template <typename Event>
+        void dispatch_fixed_events(uint64_t from, uint64_t to, Event && event)
+        {
+            size_t at = 0;
+            while(at < fixedEvents.size())
+            {
+                uint64_t pos;
+                memcpy(&pos, fixedEvents.data() + at, sizeof(uint64_t));
+                if(pos >= to) break;
+
+                auto * header = (clap_event_header*)
+                    (fixedEvents.data() + at + sizeof(uint64_t));
+                header->time = pos > from ? uint32_t(pos - from) : 0;
+                event(header);
+
+                at += sizeof(uint64_t) + ((header->size + 7) & ~7u);
+            }
+            fixedEvents.erase(fixedEvents.begin(), fixedEvents.begin() + at);
+        }
+
+        // at block boundaries (or from main thread while inactive)
+        void swap_shared_states()
+        {
+            bool swapped = false;
+            for(auto * s : sharedStates) swapped |= s->swap();
+            
+            if(swapped && isActive) clap.host->request_callback(clap.host);
+        }
+
+        // DSP side of plug_state_load() while active
+        void apply_loaded_state(const clap_output_events *out)
+        {
+            int s = statePending;
+            if(stateLoad.load(std::memory_order_relaxed) != statePending
+            || !stateLoad.compare_exchange_strong(s, stateApplying,
+                std::memory_order_acquire)) return;
+            
+            for(auto & k : stateKeys)
+            {
+                auto * p = plug_params[k.id];
+                float v = loadedValues[p->id];
+                if(v == paramStore.value[p->id]) continue;
+                
+                set_param_value(p->id, v);
+
+                clap_event_param_value ev =
+                {
+                    .header = {
+                        .size = sizeof(ev),
+                        .time = 0,
+                        .space_id = CLAP_CORE_EVENT_SPACE_ID,
+                        .type = CLAP_EVENT_PARAM_VALUE,
+                        .flags = 0,
+                    },
+
+                    .param_id = p->id,
+                    .cookie = (void*) p,
+                    
+                    .note_id = -1,
+                    .port_index = -1,
+                    .channel = -1,
+                    .key = -1,
+
+                    .value = v,
+                };
+                if(out) out->try_push(out, &ev.header);
+            }
+            
+            stateLoad.store(stateIdle, std::memory_order_release);
+        }
+
         struct {
             // automatically computed on create
             uint32_t    sizeX   = 0;
@@ -456,8 +3129,78 @@ namespace dust
             void                *parent     = 0;
         } _gui_data;
 
-        // references to parameters
+        // references to parameters (cold metadata) and their hot state
         std::vector<AudioParam*>    plug_params;
+        ClapParamStore              paramStore;
+
+        // optional, by parameter id
+        std::vector<std::unique_ptr<ClapTextCache>> textCache;
+
+        ClapParamSmoother           smoother;
+        ClapVoiceMod                voiceMod;
+
+        // current parallel_exec() job
+        ClapWorkerPool::Task        taskFn = 0;
+        void                        *taskCtx = 0;
+        ClapWorkerPool              workers;
+
+        ClapScratchArena            scratchArena;
+
+        // see process_fixed()
+        static const size_t         fixedEventsPerFrame = 64;  // bytes
+        size_t                      fixedEventBytes = 0;
+        std::atomic<uint32_t>       fixedDropped = { 0 };
+        uint32_t                    fixedSize = 0;
+        uint32_t                    fixedFill = 0;      // frames in the FIFO
+        uint64_t                    fixedStream = 0;    // frames since activate
+        std::vector<double, ClapAlignedAllocator<double>>   fixedFifo;
+        std::vector<uint8_t, ClapAlignedAllocator<uint8_t>> fixedEvents;
+
+        // see process_oversampled()
+        ClapOversampler             oversampler;
+        uint32_t                    osLog2 = 0;
+        uint32_t                    osPending = 0;
+
+        // frames since the inputs went silent, saturates at tail length
+        uint32_t                    silentFrames = 0;
+
+        bool                        isActive = false;
+
+
+        // state, see plug_state_save()
+        static const uint32_t stateMagic = 0x54534344;      // 'DCST'
+        static const uint32_t stateFormat = 1;
+        static const uint32_t stateParamTag = 0x534d5250;   // 'PRMS'
+
+        struct StateKey
+        {
+            uint32_t    key;
+            clap_id     id;
+
+            bool operator<(const StateKey & k) const { return key < k.key; }
+        };
+        
+        struct StateChunk
+        {
+            uint32_t    tag;
+            std::function<bool(ClapStateWriter &)>  save;
+            std::function<bool(ClapStateReader &)>  load;
+        };
+
+        std::vector<ClapSharedStateBase*>   sharedStates;
+
+        std::vector<StateKey>       stateKeys;  // sorted by key
+        bool                        stateKeyConflict = false;
+        unsigned                    stateNameConflicts = 0;
+        std::vector<StateChunk>     stateChunks;
+
+        // loaded parameter values waiting for the DSP
+        enum { stateIdle, statePending, stateApplying };
+        std::atomic<int>            stateLoad = { stateIdle };
+        std::vector<float>          loadedValues;
+
+        // one bit per parameter, set on DSP side, cleared by the GUI
+        std::vector<std::atomic<uint64_t>>  dirtyParams;
     };
 
 };
\ No newline at end of file
@@ -110,11 +110,11 @@ namespace dust
 
         void ev_update()
         {
-            if(!param) return;
+            // ClapBase bumps the serial when the DSP value changes
+            if(!param || param->guiSerial == guiSerial) return;
+            guiSerial = param->guiSerial;
 
-            memfence_acq();
-            float v = param->value;
-            memfence_rel();
+            float v = param->getValue();
             
             if(v != value)
             {
@@ -132,7 +132,8 @@ namespace dust
         float   value = .5;
 
     private:
-        int     dragFrom = 0;
+        int         dragFrom = 0;
+        unsigned    guiSerial = ~0u;    // force initial update
         
     };
 